@@ -9,7 +9,11 @@ if [[ ! -d $OUTPUT_DIR ]]; then
 fi
 
 glslc $SHADERS_DIR/shader.vert -o $OUTPUT_DIR/shader.vert.spv
-glslc $SHADERS_DIR/shader.frag -o $OUTPUT_DIR/shader.frag.spv
+glslc --target-env=vulkan1.2 $SHADERS_DIR/shader.frag -o $OUTPUT_DIR/shader.frag.spv
+glslc --target-env=vulkan1.2 -DALPHA_TEST $SHADERS_DIR/shader.frag -o $OUTPUT_DIR/shader.cutout.frag.spv
 
 glslc $SHADERS_DIR/grid.vert -o $OUTPUT_DIR/grid.vert.spv
 glslc $SHADERS_DIR/grid.frag -o $OUTPUT_DIR/grid.frag.spv
+
+glslc $SHADERS_DIR/cull.comp -o $OUTPUT_DIR/cull.comp.spv
+glslc $SHADERS_DIR/hiz.comp -o $OUTPUT_DIR/hiz.comp.spv
@@ -0,0 +1,21 @@
+#include "allocation-counter.hpp"
+
+#ifdef ZEPH_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+void *operator new(std::size_t size) {
+  zephyr::AllocationCounter::record();
+
+  if (void *pointer = std::malloc(size ? size : 1))
+    return pointer;
+
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace zephyr {
+
+// Counts calls to the global operator new when the engine is built with
+// ZEPH_COUNT_ALLOCATIONS. The replacement operators live in
+// allocation-counter.cpp; without the flag the count stays at zero.
+class AllocationCounter {
+public:
+  static void record() { s_count.fetch_add(1, std::memory_order_relaxed); }
+
+  static size_t count() { return s_count.load(std::memory_order_relaxed); }
+
+private:
+  static inline std::atomic<size_t> s_count{0};
+};
+
+} // namespace zephyr
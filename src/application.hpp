@@ -1,12 +1,15 @@
 #pragma once
 
+#include "allocation-counter.hpp"
 #include "assert.hpp"
 #include "base.hpp" #include "components.hpp"
 #include "entity.hpp"
 #include "event-dispatcher.hpp"
 #include "event-scheduler.hpp" #include "keyboard.hpp"
+#include "instancing.hpp"
 #include "log.hpp"
 #include "mesh.hpp"
+#include "occlusion-rasterizer.hpp"
 #include "platforms/vulkan/queue.hpp"
 #include "platforms/vulkan/render-target.hpp"
 #include "time.hpp"
@@ -50,32 +53,44 @@ public:
         .with_component(CameraTagComponent{})
         .spawn();
 
+    uint32_t stone = m_vulkan_render_target->create_texture_image(
+        "../src/assets/textures/stone_albedo.jpg");
+
+    auto cube_asset = make_mesh_asset(Mesh::cube());
+    auto cube = m_vulkan_render_target->register_mesh(cube_asset);
+    m_occlusion_rasterizer.add_mesh(cube, cube_asset);
+
+    make_entity(m_world).with_component(MeshComponent{.mesh = cube}).spawn();
+
+    // A wall between the camera and the grid's middle rows, drawn into the
+    // CPU occlusion buffer and the depth pre-pass.
     make_entity(m_world)
-        .with_component(MeshComponent{.mesh = Mesh::cube()})
+        .with_position({3.0f, 0.0f, -1.5f})
+        .with_scale({3.0f, 2.0f, 0.25f})
+        .with_component(MeshComponent{.mesh = cube})
+        .with_component(OccluderTagComponent{})
         .spawn();
 
-    for (size_t x = 0; x < 4; x++) {
-      for (size_t z = 0; z < 4; z++) {
+    auto cube_prefab =
         make_entity(m_world)
-            .with_component(MeshComponent{.mesh = Mesh::cube()})
-            .with_position(glm::vec3(x * 2, 0, z * 2))
-            .spawn();
-      }
-    }
-
-    m_vulkan_render_target->setup_uniform_buffer_slots<EntityUniformBuffer>(
-        m_world.uniforms.slots.size());
-
-    m_vulkan_render_target->create_descriptor_pool();
+            .with_component(MeshComponent{.mesh = cube})
+            .with_component(m_vulkan_render_target->make_material(stone))
+            .build_prefab();
+
+    m_world.instantiate<TransformComponent>(
+        cube_prefab, 16, [](size_t i, TransformComponent &transform) {
+          transform.position = glm::vec3((i / 4) * 2, 0, (i % 4) * 2);
+          transform.is_dirty = true;
+          transform.recalculate();
+        });
 
-    m_vulkan_render_target->create_texture_image(
-        "../src/assets/textures/stone_albedo.jpg");
-    m_vulkan_render_target->setup_descriptor_sets<EntityUniformBuffer>();
+    m_vulkan_render_target
+        ->setup_uniform_buffers<GlobalUniformBuffer, ObjectUniformBuffer>(
+            m_world.uniforms.slots.size());
 
-    auto cube = Mesh::cube();
+    m_vulkan_render_target->setup_gpu_culling();
 
-    m_vulkan_render_target->create_vertex_buffer(cube.vertices);
-    m_vulkan_render_target->create_index_buffer(cube.indices);
+    m_vulkan_render_target->upload_meshes();
 
     m_vulkan_render_target->setup_grid_pipeline();
 
@@ -87,7 +102,16 @@ public:
       window->update();
       scheduler->bind(SchedulerType::POST_FRAME);
 
+#ifdef ZEPH_COUNT_ALLOCATIONS
+      size_t allocations = AllocationCounter::count();
       draw();
+      REPORT_METRIC("frame", "heap_allocations",
+                    AllocationCounter::count() - allocations);
+#else
+      draw();
+#endif
+
+      m_world.maybe_compact();
 
       window->swap();
     }
@@ -96,15 +120,15 @@ public:
   }
 
   void draw() {
-    auto logical_device = m_vulkan_render_target->logical_device();
-    auto swap_chain = m_vulkan_render_target->swap_chain();
+    auto &logical_device = m_vulkan_render_target->logical_device();
+    auto &swap_chain = m_vulkan_render_target->swap_chain();
 
-    auto image_available_semaphores =
+    auto &image_available_semaphores =
         m_vulkan_render_target->image_available_semaphores();
-    auto render_finished_semaphores =
+    auto &render_finished_semaphores =
         m_vulkan_render_target->render_finished_semaphores();
-    auto in_flight_fences = m_vulkan_render_target->in_flight_fences();
-    auto available_command_buffers = m_vulkan_render_target->command_buffers();
+    auto &in_flight_fences = m_vulkan_render_target->in_flight_fences();
+    auto &available_command_buffers = m_vulkan_render_target->command_buffers();
     Window *window = Window::get();
 
     vkWaitForFences(logical_device.handle, 1,
@@ -126,70 +150,69 @@ public:
       ZEPH_ENSURE(result != VK_SUCCESS, "Couldn't acquire swap chain image");
     }
 
-    m_world.query<TransformComponent, CameraComponent, CameraTagComponent>(
+    m_world.query<TransformComponent, CameraComponent>(
         [&](EntityId id, TransformComponent &transform_component,
-            CameraComponent &camera_component, CameraTagComponent &_tag) {
+            CameraComponent &camera_component) {
           auto extent = m_vulkan_render_target->swap_chain().extent;
           camera_component.movement(transform_component, extent);
-        });
+        },
+        With<CameraTagComponent>{});
 
     static Timer timer;
     float time = timer.elapsed();
 
-    m_world.query<TransformComponent, ObjectTagComponent>(
-        [&](EntityId id, TransformComponent &transform_component,
-            ObjectTagComponent &_tag) {
+    m_world.query<TransformComponent>(
+        [&](EntityId id, TransformComponent &transform_component) {
           transform_component.rotation = glm::angleAxis(
               time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 
           transform_component.is_dirty = true;
           transform_component.recalculate();
-        });
+        },
+        With<ObjectTagComponent>{});
 
     vkResetFences(logical_device.handle, 1, &in_flight_fences[m_current_frame]);
 
-    std::vector<VkCommandBuffer> frame_command_buffers = {
-        available_command_buffers[m_current_frame]};
+    VkCommandBuffer command_buffer = available_command_buffers[m_current_frame];
 
-    vkResetCommandBuffer(frame_command_buffers[0], 0);
+    vkResetCommandBuffer(command_buffer, 0);
 
     m_world.update_uniforms();
 
-    uint32_t camera_slot = 0;
-    m_world.query<TransformComponent, CameraComponent, CameraTagComponent>(
-        [&](EntityId id, TransformComponent &, CameraComponent &,
-            CameraTagComponent &) {
-          if (auto *uniform = m_world.uniforms.get(id)) {
-            camera_slot = m_world.uniforms.index.at(id);
-            m_vulkan_render_target->dispatch_uniform_buffer(
-                *uniform, camera_slot, m_current_frame);
-          }
-        });
-
-    m_world.query<MeshComponent, ObjectTagComponent>(
-        [&](EntityId id, MeshComponent &, ObjectTagComponent &) {
-          if (auto *uniform = m_world.uniforms.get(id)) {
-            uint32_t slot = m_world.uniforms.index.at(id);
-            m_vulkan_render_target->dispatch_uniform_buffer(*uniform, slot,
-                                                            m_current_frame);
-          }
-        });
-
-    m_vulkan_render_target->begin_frame(frame_command_buffers[0], image_index);
-
-    m_vulkan_render_target->draw(frame_command_buffers[0], m_current_frame,
-                                 camera_slot);
-
-    m_world.query<MeshComponent, ObjectTagComponent>(
-        [&](EntityId id, MeshComponent &mesh_component,
-            ObjectTagComponent &_tag) {
-          uint32_t slot = m_world.uniforms.index.at(id);
-          m_vulkan_render_target->draw_indexed(frame_command_buffers[0],
-                                               mesh_component.mesh,
-                                               m_current_frame, slot);
-        });
-
-    m_vulkan_render_target->end_frame(frame_command_buffers[0]);
+    m_vulkan_render_target->begin_uniform_upload(m_current_frame,
+                                                 m_world.uniforms.slots.size());
+    m_vulkan_render_target->dispatch_global_uniform(m_world.uniforms.global);
+    m_vulkan_render_target->dispatch_object_uniforms(m_world.uniforms.slots);
+
+    glm::mat4 view_projection =
+        m_world.uniforms.global.projection * m_world.uniforms.global.view;
+
+    // Occluders rasterized this frame beat last frames' Hi-Z readback.
+    m_occlusion_rasterizer.render(m_world, view_projection);
+
+    if (m_occlusion_rasterizer.occluder_count() > 0)
+      m_instance_batcher.build(m_world, m_world.uniforms.global.view_position,
+                               m_vulkan_render_target->texture_blend_mode(),
+                               &m_occlusion_rasterizer);
+    else
+      m_instance_batcher.build(m_world, m_world.uniforms.global.view_position,
+                               m_vulkan_render_target->texture_blend_mode(),
+                               m_vulkan_render_target->cpu_occlusion());
+    m_vulkan_render_target->dispatch_instances(m_instance_batcher.instances());
+    m_vulkan_render_target->dispatch_draws(m_instance_batcher.batches());
+    m_vulkan_render_target->dispatch_occluders(
+        m_instance_batcher.occluder_batches(),
+        m_instance_batcher.occluder_instances());
+    m_vulkan_render_target->dispatch_cull_instances(
+        m_instance_batcher.cull_instances(), view_projection);
+    m_vulkan_render_target->flush_uniforms();
+
+    m_vulkan_render_target->begin_frame(command_buffer, image_index,
+                                        m_current_frame);
+
+    m_vulkan_render_target->record_frame(command_buffer);
+
+    m_vulkan_render_target->end_frame(command_buffer);
 
     VkSemaphore wait_semaphores[] = {
         image_available_semaphores[m_current_frame]};
@@ -198,8 +221,7 @@ public:
     VkPipelineStageFlags wait_stages[] = {
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
-    VkSubmitInfo submit_info =
-        VulkanQueue::declare_submit(frame_command_buffers);
+    VkSubmitInfo submit_info = VulkanQueue::declare_submit(command_buffer);
 
     submit_info.waitSemaphoreCount = 1;
     submit_info.pWaitSemaphores = wait_semaphores;
@@ -239,6 +261,8 @@ private:
 
   uint32_t m_current_frame = 0;
   World m_world;
+  InstanceBatcher m_instance_batcher;
+  OcclusionRasterizer m_occlusion_rasterizer;
 };
 
 } // namespace zephyr
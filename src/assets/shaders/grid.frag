@@ -5,8 +5,7 @@ layout(location = 1) in vec3 far_point;
 
 layout(location = 0) out vec4 out_color;
 
-layout(binding = 0) uniform UniformBufferObject {
-  mat4 model;
+layout(binding = 0) uniform GlobalUniformBuffer {
   mat4 view;
   mat4 projection;
   float time;
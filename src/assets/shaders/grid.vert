@@ -3,8 +3,7 @@
 layout(location = 0) out vec3 near_point;
 layout(location = 1) out vec3 far_point;
 
-layout(binding = 0) uniform UniformBufferObject {
-  mat4 model;
+layout(binding = 0) uniform GlobalUniformBuffer {
   mat4 view;
   mat4 projection;
   float time;
@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout (location = 0) out vec4 out_color;
 layout (location = 0) in vec3 color;
@@ -8,11 +9,17 @@ layout (location = 3) in vec3 view_position;
 layout (location = 4) in vec3 frag_world_pos;
 layout (location = 5) in vec3 camera_forward;
 layout (location = 6) in vec2 ndc_pos;
+layout (location = 7) flat in uint texture_index;
 
-layout (binding = 1) uniform sampler2D tex_sampler;
+layout (set = 1, binding = 0) uniform sampler2D textures[];
 
 void main(){
-  vec4 tex = texture(tex_sampler, texture_coordinates);
+  vec4 tex = texture(textures[nonuniformEXT(texture_index)], texture_coordinates);
+
+#ifdef ALPHA_TEST
+  if (tex.a < 0.5)
+    discard;
+#endif
 
   float dist = length(ndc_pos);
 
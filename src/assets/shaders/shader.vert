@@ -10,9 +10,9 @@ layout (location = 3) out vec3 view_position;
 layout (location = 4) out vec3 frag_world_pos;
 layout (location = 5) out vec3 camera_forward;
 layout (location = 6) out vec2 ndc_pos;
+layout (location = 7) flat out uint texture_index;
 
-layout(binding = 0) uniform UniformBufferObject{
-  mat4 model;
+layout(binding = 0) uniform GlobalUniformBuffer {
   mat4 view;
   mat4 projection;
   float time;
@@ -20,13 +20,30 @@ layout(binding = 0) uniform UniformBufferObject{
   vec3 camera_forward;
 } ubo;
 
+struct ObjectData {
+  vec4 model_rows[3];
+  uint texture;
+};
+
+layout(std430, binding = 2) readonly buffer ObjectBuffer {
+  ObjectData objects[];
+};
+
+layout(std430, binding = 3) readonly buffer InstanceBuffer {
+  uint instance_slots[];
+};
+
 void main(){
-  gl_Position = ubo.projection * ubo.view * ubo.model * vec4(in_position, 1.0);
+  ObjectData object = objects[instance_slots[gl_InstanceIndex]];
+  mat4 model = transpose(mat4(object.model_rows[0], object.model_rows[1],
+                              object.model_rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
 
+  gl_Position = ubo.projection * ubo.view * model * vec4(in_position, 1.0);
 
-  frag_normal = transpose(inverse(mat3(ubo.model))) * in_normal;
 
-  frag_world_pos = vec3(ubo.model * vec4(in_position, 1.0));
+  frag_normal = transpose(inverse(mat3(model))) * in_normal;
+
+  frag_world_pos = vec3(model * vec4(in_position, 1.0));
 
   float dist = length(in_position);
   float attenuation = 1.0 / (1.0 + dist * dist);
@@ -41,4 +58,6 @@ void main(){
 
   camera_forward = ubo.camera_forward;
   ndc_pos = gl_Position.xy / gl_Position.w;
+
+  texture_index = object.texture;
 }
@@ -2,6 +2,7 @@
 
 #include "glm/gtx/quaternion.hpp"
 #include "keyboard.hpp"
+#include "material.hpp"
 #include "mesh.hpp"
 #include "time.hpp"
 #include "window.hpp"
@@ -135,10 +136,28 @@ struct CameraComponent {
 };
 
 struct MeshComponent {
-  Mesh mesh = Mesh::cube();
+  MeshHandle mesh;
+};
+
+// Per-entity surface: how it blends and which texture-table entry it
+// samples. Entities without one use texture 0 and its blend mode. The blend
+// mode follows from the texture, so build these with
+// VulkanRenderTarget::make_material() and rebuild them when the texture
+// changes.
+struct MaterialComponent {
+  BlendMode blend = BlendMode::OPAQUE;
+  uint32_t texture = 0;
+};
+
+// Index of the entity's object data in the world's UniformTable and in the
+// GPU object buffer.
+struct RenderSlotComponent {
+  uint32_t slot = 0;
 };
 
 struct CameraTagComponent {};
 struct ObjectTagComponent {};
+// Large opaque meshes drawn into the depth pre-pass to occlude the rest.
+struct OccluderTagComponent {};
 
 } // namespace zephyr
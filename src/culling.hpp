@@ -0,0 +1,159 @@
+#pragma once
+
+#include "base.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace zephyr {
+
+// One drawable instance as the culling shader sees it. Matches the std430
+// CullInstance struct in cull.comp.
+struct CullInstance {
+  glm::vec4 bounds;
+  uint32_t slot;
+  uint32_t batch;
+  uint32_t padding[2];
+};
+
+static_assert(sizeof(CullInstance) == 32);
+
+// Counters the culling shader bumps with atomics. Matches the std430
+// CullStats struct in cull.comp.
+struct CullStats {
+  uint32_t tested = 0;
+  uint32_t frustum_culled = 0;
+  uint32_t occlusion_culled = 0;
+  uint32_t padding = 0;
+};
+
+// What the culling shader needs besides the frustum. Matches the std430
+// CullParams block in cull.comp; the shader adds to `stats`.
+struct CullParams {
+  glm::mat4 occlusion_view_projection{1.0f};
+  glm::vec2 hiz_size{0.0f};
+  uint32_t hiz_levels = 0;
+  uint32_t occlusion = 0;
+  CullStats stats;
+};
+
+static_assert(sizeof(CullParams) == 96);
+
+// A local bounding sphere moved by `model`, with the radius scaled by the
+// largest axis so it stays conservative under non-uniform scale.
+inline glm::vec4 world_sphere(const glm::mat4 &model, glm::vec4 bounds) {
+  glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(bounds), 1.0f));
+  float scale = std::sqrt(std::max(
+      glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+      std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])),
+               glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+
+  return glm::vec4(center, bounds.w * scale);
+}
+
+// Screen rectangle in [0, 1] and nearest depth of a sphere's bounding box.
+struct ScreenRect {
+  glm::vec2 min;
+  glm::vec2 max;
+  float depth;
+};
+
+// Returns false when the box crosses the near plane, where the projection
+// is meaningless and the sphere has to count as visible. Same math as
+// project_sphere() in cull.comp.
+inline bool project_sphere(const glm::mat4 &view_projection, glm::vec3 center,
+                           float radius, ScreenRect &rect) {
+  rect.min = glm::vec2(1.0f);
+  rect.max = glm::vec2(0.0f);
+  rect.depth = 1.0f;
+
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 corner =
+        center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f,
+                                    i & 2 ? 1.0f : -1.0f,
+                                    i & 4 ? 1.0f : -1.0f);
+    glm::vec4 clip = view_projection * glm::vec4(corner, 1.0f);
+
+    if (clip.w <= 0.0f)
+      return false;
+
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    glm::vec2 uv = glm::vec2(ndc) * 0.5f + 0.5f;
+
+    rect.min = glm::min(rect.min, uv);
+    rect.max = glm::max(rect.max, uv);
+    rect.depth = std::min(rect.depth, ndc.z);
+  }
+
+  return true;
+}
+
+// One level of the Hi-Z pyramid read back to the host, with the
+// view-projection it was rendered with. Each texel holds the farthest depth
+// it covers, so a sphere whose nearest point is behind every texel under it
+// is hidden.
+struct OcclusionDepth {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<float> depth;
+  glm::mat4 view_projection{1.0f};
+
+  bool empty() const { return depth.empty(); }
+
+  // Only spheres that were fully on screen when the depth was taken can be
+  // rejected; anything else is unknown and stays visible.
+  bool occludes(glm::vec3 center, float radius) const {
+    ScreenRect rect;
+    if (empty() || !project_sphere(view_projection, center, radius, rect))
+      return false;
+
+    if (rect.min.x < 0.0f || rect.min.y < 0.0f || rect.max.x > 1.0f ||
+        rect.max.y > 1.0f)
+      return false;
+
+    uint32_t x0 = std::min(static_cast<uint32_t>(rect.min.x * width), width - 1);
+    uint32_t y0 =
+        std::min(static_cast<uint32_t>(rect.min.y * height), height - 1);
+    uint32_t x1 = std::min(static_cast<uint32_t>(rect.max.x * width), width - 1);
+    uint32_t y1 =
+        std::min(static_cast<uint32_t>(rect.max.y * height), height - 1);
+
+    for (uint32_t y = y0; y <= y1; y++) {
+      for (uint32_t x = x0; x <= x1; x++) {
+        if (rect.depth <= depth[y * width + x])
+          return false;
+      }
+    }
+
+    return true;
+  }
+};
+
+// Frustum planes pointing inwards, normalised so a sphere test is a single
+// dot product per plane.
+struct CullFrustum {
+  std::array<glm::vec4, 6> planes;
+
+  // Gribb-Hartmann extraction. Depth is [0, 1], so the near plane is the
+  // third row alone.
+  static CullFrustum from(const glm::mat4 &view_projection) {
+    auto row = [&](int i) {
+      return glm::vec4(view_projection[0][i], view_projection[1][i],
+                       view_projection[2][i], view_projection[3][i]);
+    };
+
+    CullFrustum frustum{};
+    frustum.planes = {row(3) + row(0), row(3) - row(0), row(3) + row(1),
+                      row(3) - row(1), row(2),          row(3) - row(2)};
+
+    for (auto &plane : frustum.planes)
+      plane /= glm::length(glm::vec3(plane));
+
+    return frustum;
+  }
+};
+
+} // namespace zephyr
@@ -1,12 +1,19 @@
 #pragma once
+#include "assert.hpp"
 #include "base.hpp"
 #include "components.hpp"
 #include "log.hpp"
 #include "mesh.hpp"
 #include "platforms/vulkan/swap-chain.hpp"
+#include "snapshot.hpp"
 #include "time.hpp"
 #include "uniforms.hpp"
 #include "window.hpp"
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <vulkan/vulkan_core.h>
 
@@ -20,28 +27,288 @@ template <> struct hash<std::bitset<zephyr::MAX_COMPONENTS>> {
 
 namespace zephyr {
 
+struct ComponentInfo {
+  uint64_t stable_id = 0;
+  size_t size = 0;
+  size_t alignment = 0;
+  bool trivially_copyable = false;
+};
+
 namespace internal {
 inline ComponentTypeId next_component_id() {
   static ComponentTypeId counter = 0;
   return counter++;
 }
+
+inline std::vector<ComponentInfo> &component_infos() {
+  static std::vector<ComponentInfo> infos;
+  return infos;
+}
+
+// FNV-1a over the type name as spelled in __PRETTY_FUNCTION__, trimmed to
+// the "T = ..." part so GCC and Clang agree. Unlike ComponentTypeId it does
+// not depend on registration order, which makes it safe to persist.
+template <typename T> uint64_t stable_type_hash() {
+  std::string_view name = __PRETTY_FUNCTION__;
+  size_t begin = name.find("T = ");
+  begin = begin == std::string_view::npos ? 0 : begin + 4;
+  size_t end = name.find_first_of(";]", begin);
+  name = name.substr(begin, end - begin);
+
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+template <typename T> ComponentTypeId register_component() {
+  ComponentTypeId id = next_component_id();
+
+  auto &infos = component_infos();
+  if (infos.size() <= id)
+    infos.resize(id + 1);
+
+  infos[id] = {.stable_id = stable_type_hash<T>(),
+               .size = sizeof(T),
+               .alignment = alignof(T),
+               .trivially_copyable = std::is_trivially_copyable_v<T>};
+  return id;
+}
 } // namespace internal
 
 template <typename T> inline ComponentTypeId component_type_id() {
-  static ComponentTypeId id = internal::next_component_id();
+  static ComponentTypeId id = internal::register_component<T>();
   return id;
 }
 
+inline const ComponentInfo &component_info(ComponentTypeId id) {
+  return internal::component_infos().at(id);
+}
+
+inline std::optional<ComponentTypeId> find_component(uint64_t stable_id) {
+  auto &infos = internal::component_infos();
+  for (ComponentTypeId id = 0; id < infos.size(); id++)
+    if (infos[id].stable_id == stable_id)
+      return id;
+  return std::nullopt;
+}
+
 struct Column {
   size_t stride = 0;
   std::vector<std::byte> data;
+
+  // World change tick of the last write to each snapshot chunk.
+  std::vector<uint32_t> chunk_ticks;
+
   size_t count() const { return stride ? data.size() / stride : 0; }
+  size_t capacity_bytes() const { return data.capacity(); }
+
+  size_t rows_per_chunk() const {
+    return std::max<size_t>(1, SNAPSHOT_CHUNK_BYTES / stride);
+  }
+
+  size_t chunk_count() const {
+    return (count() + rows_per_chunk() - 1) / rows_per_chunk();
+  }
+
+  void touch(size_t row, uint32_t tick) {
+    size_t chunk = row / rows_per_chunk();
+    if (chunk >= chunk_ticks.size())
+      chunk_ticks.resize(chunk + 1, tick);
+    chunk_ticks[chunk] = tick;
+  }
+
+  void touch_all(uint32_t tick) { chunk_ticks.assign(chunk_count(), tick); }
+
+  bool changed_since(size_t chunk, uint32_t tick) const {
+    return chunk >= chunk_ticks.size() || chunk_ticks[chunk] > tick;
+  }
 };
 
 struct ArchetypeStorage {
   ArchetypeSignature signature;
   std::vector<EntityId> entity_ids;
   std::unordered_map<ComponentTypeId, Column> columns;
+
+  size_t capacity_bytes() const {
+    size_t bytes = entity_ids.capacity() * sizeof(EntityId);
+    for (auto &[_, col] : columns)
+      bytes += col.capacity_bytes();
+    return bytes;
+  }
+
+  template <typename T> T *column() {
+    auto it = columns.find(component_type_id<T>());
+    return it != columns.end() ? reinterpret_cast<T *>(it->second.data.data())
+                               : nullptr;
+  }
+
+  template <typename T> void touch(uint32_t tick) {
+    auto it = columns.find(component_type_id<T>());
+    if (it != columns.end())
+      it->second.touch_all(tick);
+  }
+};
+
+// Query filter terms. With<T> requires T without handing it to the callback,
+// Without<T> rejects archetypes holding T, and Optional<T> passes a T* that
+// is null for archetypes lacking it. All terms are resolved per archetype.
+template <typename T> struct With {};
+template <typename T> struct Without {};
+template <typename T> struct Optional {};
+
+namespace internal {
+template <typename Fn> struct CallParams {
+  static constexpr bool known = false;
+  using type = std::tuple<>;
+};
+
+template <typename C, typename R, typename... Args>
+struct CallParams<R (C::*)(Args...)> {
+  static constexpr bool known = true;
+  using type = std::tuple<Args...>;
+};
+
+template <typename C, typename R, typename... Args>
+struct CallParams<R (C::*)(Args...) const> : CallParams<R (C::*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct CallParams<R (C::*)(Args...) noexcept>
+    : CallParams<R (C::*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct CallParams<R (C::*)(Args...) const noexcept>
+    : CallParams<R (C::*)(Args...)> {};
+
+template <typename R, typename... Args> struct CallParams<R (*)(Args...)> {
+  static constexpr bool known = true;
+  using type = std::tuple<Args...>;
+};
+
+template <typename R, typename... Args>
+struct CallParams<R (*)(Args...) noexcept> : CallParams<R (*)(Args...)> {};
+
+// Parameter list of a query callback. A generic lambda is inspected through
+// its specialization for the query's component types, which is what `auto &`,
+// `const auto &` and `auto` parameters deduce. `Components` is void when the
+// query also passes pointers, whose parameter forms can't be guessed, and the
+// parameters then stay unknown.
+template <typename Fn, typename Components, typename = void>
+struct CallbackParams : CallParams<Fn> {};
+
+template <typename Fn, typename Components>
+struct CallbackParams<Fn, Components, std::void_t<decltype(&Fn::operator())>>
+    : CallParams<decltype(&Fn::operator())> {};
+
+template <typename Fn, typename... Cs>
+struct CallbackParams<
+    Fn, std::tuple<Cs...>,
+    std::void_t<decltype(&Fn::template operator()<Cs...>)>>
+    : CallParams<decltype(&Fn::template operator()<Cs...>)> {};
+
+template <typename T, typename Param>
+constexpr bool writes_param = std::is_same_v<Param, T &> ||
+                              std::is_same_v<Param, T &&> ||
+                              std::is_same_v<Param, T *>;
+
+// Whether the callback takes T by non-const reference or pointer, and so may
+// change it. Unknown callbacks are assumed to.
+template <typename Fn, typename Components, typename T>
+constexpr bool callback_writes() {
+  using Params = CallbackParams<std::remove_cvref_t<Fn>, Components>;
+
+  if constexpr (!Params::known) {
+    return true;
+  } else {
+    return []<typename... Args>(std::tuple<Args...> *) {
+      return (writes_param<T, Args> || ...);
+    }(static_cast<typename Params::type *>(nullptr));
+  }
+}
+
+template <typename Term> struct QueryTerm;
+
+template <typename Term> constexpr bool is_optional = false;
+template <typename T> constexpr bool is_optional<Optional<T>> = true;
+
+template <typename T> struct QueryTerm<With<T>> {
+  static void apply(ArchetypeSignature &include, ArchetypeSignature &) {
+    include.set(component_type_id<T>());
+  }
+  template <typename Fn, typename Components>
+  static std::tuple<> columns(ArchetypeStorage &, uint32_t) {
+    return {};
+  }
+};
+
+template <typename T> struct QueryTerm<Without<T>> {
+  static void apply(ArchetypeSignature &, ArchetypeSignature &exclude) {
+    exclude.set(component_type_id<T>());
+  }
+  template <typename Fn, typename Components>
+  static std::tuple<> columns(ArchetypeStorage &, uint32_t) {
+    return {};
+  }
+};
+
+template <typename T> struct QueryTerm<Optional<T>> {
+  static void apply(ArchetypeSignature &, ArchetypeSignature &) {}
+  template <typename Fn, typename Components>
+  static std::tuple<T *> columns(ArchetypeStorage &arch, uint32_t tick) {
+    if constexpr (callback_writes<Fn, Components, T>())
+      arch.touch<T>(tick);
+    return {arch.column<T>()};
+  }
+};
+} // namespace internal
+
+// Template rows that World::instantiate clones from. Each row is one entity
+// of the prefab kept as a single-row archetype outside World::archetypes, so
+// queries never visit it.
+struct Prefab {
+  std::vector<ArchetypeStorage> rows;
+
+  // Components are kept as raw bytes and cloned with memcpy, so they must
+  // not own memory.
+  template <typename... Ts> Prefab &add_row(Ts... components) {
+    static_assert((std::is_trivially_copyable_v<Ts> && ...),
+                  "Prefab components must be trivially copyable");
+
+    ArchetypeStorage &row = rows.emplace_back();
+    (row.signature.set(component_type_id<Ts>()), ...);
+
+    (
+        [&](auto component) {
+          using T = decltype(component);
+          Column &col = row.columns[component_type_id<T>()];
+          col.stride = sizeof(T);
+          const auto *bytes = reinterpret_cast<const std::byte *>(&component);
+          col.data.assign(bytes, bytes + sizeof(T));
+        }(components),
+        ...);
+
+    return *this;
+  }
+
+  Prefab &append(const Prefab &child) {
+    rows.insert(rows.end(), child.rows.begin(), child.rows.end());
+    return *this;
+  }
+};
+
+struct CompactionStats {
+  size_t bytes_reclaimed = 0;
+  size_t archetypes_released = 0;
+};
+
+// Thresholds for World::maybe_compact, checked once per frame. Compaction
+// invalidates component references, so it must never run inside a query.
+struct CompactionPolicy {
+  bool enabled = true;
+  size_t despawn_threshold = 4096;
+  size_t empty_archetype_threshold = 64;
 };
 
 struct EntityRecord {
@@ -53,13 +320,16 @@ struct World {
   std::unordered_map<ArchetypeSignature, ArchetypeStorage> archetypes;
   std::unordered_map<EntityId, EntityRecord> entity_records;
   UniformTable uniforms;
+  CompactionPolicy compaction_policy;
   EntityId m_next_id = 0;
+  size_t m_despawns_since_compact = 0;
+  uint32_t m_change_tick = 1;
+  SnapshotRing m_snapshots;
 
   EntityId spawn() {
     EntityId id = m_next_id++;
 
     entity_records[id] = {nullptr, 0};
-    uniforms.allocate(id);
 
     return id;
   }
@@ -69,10 +339,75 @@ struct World {
     if (it == entity_records.end())
       return;
     auto &[arch, row] = it->second;
-    if (arch)
+    if (arch) {
+      if (auto *slots = arch->column<RenderSlotComponent>())
+        uniforms.free(slots[row].slot);
       swap_remove(*arch, id, row);
-    uniforms.free(id);
+    }
     entity_records.erase(id);
+    m_despawns_since_compact++;
+  }
+
+  // Returns unused column capacity to the allocator and drops archetypes that
+  // no longer hold any entity, so queries stop visiting them.
+  CompactionStats compact() {
+    CompactionStats stats;
+
+    for (auto it = archetypes.begin(); it != archetypes.end();) {
+      ArchetypeStorage &arch = it->second;
+      size_t before = arch.capacity_bytes();
+
+      if (arch.entity_ids.empty()) {
+        stats.bytes_reclaimed += before;
+        stats.archetypes_released++;
+        it = archetypes.erase(it);
+        continue;
+      }
+
+      arch.entity_ids.shrink_to_fit();
+      for (auto &[_, col] : arch.columns) {
+        col.data.shrink_to_fit();
+        // Ticks past the last row would outlive the chunks they describe.
+        col.chunk_ticks.resize(col.chunk_count());
+        col.chunk_ticks.shrink_to_fit();
+      }
+
+      stats.bytes_reclaimed += before - arch.capacity_bytes();
+      ++it;
+    }
+
+    size_t buckets_before = entity_records.bucket_count();
+    entity_records.rehash(0);
+    if (entity_records.bucket_count() < buckets_before)
+      stats.bytes_reclaimed +=
+          (buckets_before - entity_records.bucket_count()) * sizeof(void *);
+
+    m_despawns_since_compact = 0;
+
+    REPORT_METRIC("world", "compaction_bytes_reclaimed",
+                  stats.bytes_reclaimed);
+    REPORT_METRIC("world", "compaction_archetypes_released",
+                  stats.archetypes_released);
+
+    return stats;
+  }
+
+  std::optional<CompactionStats> maybe_compact() {
+    if (!compaction_policy.enabled)
+      return std::nullopt;
+
+    if (m_despawns_since_compact >= compaction_policy.despawn_threshold)
+      return compact();
+
+    size_t empty_archetypes = 0;
+    for (auto &[_, arch] : archetypes)
+      if (arch.entity_ids.empty())
+        empty_archetypes++;
+
+    if (empty_archetypes >= compaction_policy.empty_archetype_threshold)
+      return compact();
+
+    return std::nullopt;
   }
 
   template <typename T> void add_component(EntityId id, T component) {
@@ -96,6 +431,7 @@ struct World {
         new_col.data.insert(
             new_col.data.end(), old_col.data.begin() + old_row * old_col.stride,
             old_col.data.begin() + (old_row + 1) * old_col.stride);
+        new_col.touch(new_row, m_change_tick);
       }
       swap_remove(*old_arch, id, old_row);
     }
@@ -105,6 +441,7 @@ struct World {
 
     const auto *bytes = reinterpret_cast<const std::byte *>(&component);
     col.data.insert(col.data.end(), bytes, bytes + sizeof(T));
+    col.touch(new_row, m_change_tick);
 
     new_arch.entity_ids.push_back(id);
     entity_records[id] = {&new_arch, new_row};
@@ -130,6 +467,7 @@ struct World {
         new_col.data.insert(
             new_col.data.end(), old_col.data.begin() + old_row * old_col.stride,
             old_col.data.begin() + (old_row + 1) * old_col.stride);
+        new_col.touch(new_row, m_change_tick);
       }
       swap_remove(*old_arch, id, old_row);
     }
@@ -141,6 +479,7 @@ struct World {
           col.stride = sizeof(T);
           const auto *bytes = reinterpret_cast<const std::byte *>(&component);
           col.data.insert(col.data.end(), bytes, bytes + sizeof(T));
+          col.touch(new_row, m_change_tick);
         }(components),
         ...);
 
@@ -156,6 +495,7 @@ struct World {
     auto col_it = arch->columns.find(component_type_id<T>());
     if (col_it == arch->columns.end())
       return nullptr;
+    col_it->second.touch(row, m_change_tick);
     return reinterpret_cast<T *>(col_it->second.data.data() + row * sizeof(T));
   }
 
@@ -196,11 +536,12 @@ struct World {
   }
 
   void update_uniforms() {
-    CameraComponent *camera_component = nullptr;
-    TransformComponent *camera_transform = nullptr;
+    const CameraComponent *camera_component = nullptr;
+    const TransformComponent *camera_transform = nullptr;
 
     query<TransformComponent, CameraComponent>(
-        [&](EntityId, TransformComponent &transform, CameraComponent &camera) {
+        [&](EntityId, const TransformComponent &transform,
+            const CameraComponent &camera) {
           camera_component = &camera;
           camera_transform = &transform;
         });
@@ -208,30 +549,308 @@ struct World {
     if (!camera_component && !camera_transform)
       return;
 
-    query<TransformComponent>([&](EntityId id, TransformComponent &transform) {
-      if (auto *uniform = uniforms.get(id))
-        uniform->update(transform, *camera_component, *camera_transform);
-    });
+    uniforms.global.update(*camera_component, *camera_transform);
+
+    query<TransformComponent, RenderSlotComponent>(
+        [&](EntityId, const TransformComponent &transform,
+            const RenderSlotComponent &slot,
+            const MaterialComponent *material) {
+          uniforms[slot.slot].update(transform,
+                                     material ? material->texture : 0);
+        },
+        Optional<MaterialComponent>{});
+  }
+
+  // Hands a fresh uniform slot to every row from `first_row` on. Used when
+  // rows arrive as bytes (prefabs, scenes, snapshots) and their stored slot
+  // values belong to another table.
+  void assign_render_slots(ArchetypeStorage &arch, size_t first_row = 0) {
+    auto *slots = arch.column<RenderSlotComponent>();
+    if (!slots)
+      return;
+
+    for (size_t row = first_row; row < arch.entity_ids.size(); row++)
+      slots[row].slot = uniforms.allocate();
+  }
+
+  // Spawns `count` copies of every prefab row. Each column of the target
+  // archetype grows once and is filled from the template bytes. The returned
+  // ids are grouped by row: ids[row * count + i].
+  std::vector<EntityId> instantiate(const Prefab &prefab, size_t count) {
+    std::vector<EntityId> ids;
+    ids.reserve(prefab.rows.size() * count);
+
+    for (auto &row : prefab.rows)
+      instantiate_row(row, count, ids);
+
+    return ids;
+  }
+
+  // Same as above, then hands the root row's T of each instance to `patch`
+  // as (instance index, component) so per-instance fields can be overridden.
+  template <typename T, typename Fn>
+  std::vector<EntityId> instantiate(const Prefab &prefab, size_t count,
+                                    Fn &&patch) {
+    ZEPH_ENSURE(prefab.rows.empty(), "Can't instantiate an empty prefab");
+
+    std::vector<EntityId> ids;
+    ids.reserve(prefab.rows.size() * count);
+
+    size_t first = instantiate_row(prefab.rows[0], count, ids);
+
+    ArchetypeStorage &root = archetypes[prefab.rows[0].signature];
+    T *components = root.column<T>();
+
+    ZEPH_ENSURE(!components, "Prefab root has no component to patch");
+
+    for (size_t i = 0; i < count; i++)
+      patch(i, components[first + i]);
+
+    for (size_t r = 1; r < prefab.rows.size(); r++)
+      instantiate_row(prefab.rows[r], count, ids);
+
+    return ids;
+  }
+
+  void enable_snapshots(size_t capacity) {
+    ZEPH_ENSURE(capacity < 2, "Snapshot ring needs at least two slots");
+    m_snapshots.reserve(capacity);
+  }
+
+  size_t snapshot_count() const { return m_snapshots.size(); }
+
+  // The capture taken `frames_back` snapshots ago, or null if the ring holds
+  // fewer.
+  const WorldSnapshot *snapshot_at(size_t frames_back) const {
+    return m_snapshots.at(frames_back);
+  }
+
+  // Captures every archetype into the next ring slot. Chunks whose change
+  // tick predates the previous snapshot are shared with it instead of being
+  // copied, and chunk buffers of the overwritten slot are reused in place.
+  SnapshotStats snapshot() {
+    ZEPH_ENSURE(m_snapshots.capacity() == 0,
+                "Snapshots must be enabled before capturing the world");
+
+    SnapshotStats stats;
+
+    const WorldSnapshot *previous = m_snapshots.latest();
+    WorldSnapshot &snap = m_snapshots.acquire();
+
+    snap.tick = m_change_tick;
+    snap.next_id = m_next_id;
+    snap.archetype_count = 0;
+
+    if (snap.archetypes.size() < archetypes.size())
+      snap.archetypes.resize(archetypes.size());
+
+    for (auto &[sig, arch] : archetypes) {
+      if (arch.entity_ids.empty())
+        continue;
+
+      size_t index = snap.archetype_count++;
+      ArchetypeSnapshot &arch_snap = snap.archetypes[index];
+      const ArchetypeSnapshot *prev_arch =
+          previous ? previous->find(sig, index) : nullptr;
+
+      arch_snap.signature = sig;
+      arch_snap.entity_ids.assign(arch.entity_ids.begin(),
+                                  arch.entity_ids.end());
+      arch_snap.columns.resize(arch.columns.size());
+
+      size_t column_index = 0;
+      for (auto &[ct, col] : arch.columns) {
+        ColumnSnapshot &col_snap = arch_snap.columns[column_index++];
+        const ColumnSnapshot *prev_col =
+            prev_arch ? prev_arch->find(ct) : nullptr;
+
+        col_snap.component = ct;
+        col_snap.stride = col.stride;
+        col_snap.size = col.data.size();
+
+        size_t chunk_bytes = col.rows_per_chunk() * col.stride;
+        size_t chunk_count = col.chunk_count();
+        col_snap.chunks.resize(chunk_count);
+
+        for (size_t c = 0; c < chunk_count; c++) {
+          size_t begin = c * chunk_bytes;
+          size_t length = std::min(chunk_bytes, col.data.size() - begin);
+
+          if (prev_col && c < prev_col->chunks.size() &&
+              !col.changed_since(c, previous->tick) &&
+              prev_col->chunks[c]->size() == length) {
+            col_snap.chunks[c] = prev_col->chunks[c];
+            stats.chunks_shared++;
+            continue;
+          }
+
+          auto *source = col.data.data() + begin;
+          if (col_snap.chunks[c] && col_snap.chunks[c].use_count() == 1) {
+            col_snap.chunks[c]->assign(source, source + length);
+          } else {
+            col_snap.chunks[c] =
+                create_ref<std::vector<std::byte>>(source, source + length);
+          }
+
+          stats.bytes_copied += length;
+          stats.chunks_copied++;
+        }
+      }
+    }
+
+    m_change_tick++;
+
+    REPORT_METRIC("world", "snapshot_bytes_copied", stats.bytes_copied);
+    REPORT_METRIC("world", "snapshot_chunks_shared", stats.chunks_shared);
+
+    return stats;
+  }
+
+  // Rewinds the world to the snapshot taken `frames_back` captures ago and
+  // discards the newer ones. Entities that never received a component are
+  // not part of any archetype and are therefore not restored.
+  void restore(size_t frames_back = 0) {
+    const WorldSnapshot *snap = m_snapshots.at(frames_back);
+
+    ZEPH_ENSURE(!snap, "No snapshot available ", frames_back,
+                " captures back");
+
+    for (auto &[sig, arch] : archetypes) {
+      arch.entity_ids.clear();
+      for (auto &[ct, col] : arch.columns) {
+        col.data.clear();
+        col.chunk_ticks.clear();
+      }
+    }
+
+    entity_records.clear();
+    uniforms.clear();
+
+    for (size_t i = 0; i < snap->archetype_count; i++) {
+      const ArchetypeSnapshot &arch_snap = snap->archetypes[i];
+
+      ArchetypeStorage &arch = archetypes[arch_snap.signature];
+      arch.signature = arch_snap.signature;
+      arch.entity_ids.assign(arch_snap.entity_ids.begin(),
+                             arch_snap.entity_ids.end());
+
+      for (auto &col_snap : arch_snap.columns) {
+        Column &col = arch.columns[col_snap.component];
+        col.stride = col_snap.stride;
+        col.data.resize(col_snap.size);
+
+        size_t offset = 0;
+        for (auto &chunk : col_snap.chunks) {
+          std::memcpy(col.data.data() + offset, chunk->data(), chunk->size());
+          offset += chunk->size();
+        }
+
+        col.touch_all(m_change_tick);
+      }
+
+      for (size_t row = 0; row < arch.entity_ids.size(); row++)
+        entity_records[arch.entity_ids[row]] = {&arch, row};
+
+      // Archetypes missing from the capture are now empty and hold no slots.
+      assign_render_slots(arch);
+    }
+
+    m_next_id = snap->next_id;
+
+    m_snapshots.drop_newer(frames_back);
   }
 
-  template <typename... Ts, typename Fn> void query(Fn &&fn) {
-    ArchetypeSignature required;
-    (required.set(component_type_id<Ts>()), ...);
+  template <typename... Ts, typename Fn, typename... Terms>
+  void query(Fn &&fn, Terms...) {
+    ArchetypeSignature include;
+    ArchetypeSignature exclude;
+    (include.set(component_type_id<Ts>()), ...);
+    (internal::QueryTerm<Terms>::apply(include, exclude), ...);
+
+    using Components =
+        std::conditional_t<(internal::is_optional<Terms> || ...), void,
+                           std::tuple<Ts...>>;
 
     for (auto &[sig, arch] : archetypes) {
-      if ((sig & required) != required || arch.entity_ids.empty())
+      if ((sig & include) != include || (sig & exclude).any() ||
+          arch.entity_ids.empty())
         continue;
+
+      // Only columns the callback can write are marked changed, so
+      // read-only queries don't make snapshots copy them again.
+      (
+          [&] {
+            if constexpr (internal::callback_writes<Fn, Components, Ts>())
+              arch.template touch<Ts>(m_change_tick);
+          }(),
+          ...);
+
+      std::tuple<Ts *...> required{arch.template column<Ts>()...};
+      auto optional = std::tuple_cat(
+          internal::QueryTerm<Terms>::template columns<Fn, Components>(
+              arch, m_change_tick)...);
+
       size_t count = arch.entity_ids.size();
       for (size_t i = 0; i < count; ++i) {
-        fn(arch.entity_ids[i],
-           *reinterpret_cast<Ts *>(
-               arch.columns[component_type_id<Ts>()].data.data() +
-               i * sizeof(Ts))...);
+        std::apply(
+            [&](Ts *...components) {
+              std::apply(
+                  [&](auto *...optionals) {
+                    fn(arch.entity_ids[i], components[i]...,
+                       (optionals ? optionals + i : nullptr)...);
+                  },
+                  optional);
+            },
+            required);
       }
     }
   }
 
 private:
+  size_t instantiate_row(const ArchetypeStorage &row, size_t count,
+                         std::vector<EntityId> &ids) {
+    // Checked up front so a bad row leaves the world untouched.
+    for (auto &[ct, source] : row.columns) {
+      ZEPH_ENSURE(!component_info(ct).trivially_copyable, "Component ", ct,
+                  " is not trivially copyable and can't be instantiated");
+    }
+
+    ArchetypeStorage &arch = archetypes[row.signature];
+    arch.signature = row.signature;
+    size_t first = arch.entity_ids.size();
+
+    for (auto &[ct, source] : row.columns) {
+      Column &col = arch.columns[ct];
+      col.stride = source.stride;
+
+      size_t offset = col.data.size();
+      col.data.resize(offset + count * source.stride);
+
+      std::byte *dst = col.data.data() + offset;
+      for (size_t i = 0; i < count; i++, dst += source.stride)
+        std::memcpy(dst, source.data.data(), source.stride);
+
+      for (size_t r = first; r < first + count; r += col.rows_per_chunk())
+        col.touch(r, m_change_tick);
+      if (count > 0)
+        col.touch(first + count - 1, m_change_tick);
+    }
+
+    arch.entity_ids.reserve(first + count);
+    entity_records.reserve(entity_records.size() + count);
+
+    for (size_t i = 0; i < count; i++) {
+      EntityId id = m_next_id++;
+      arch.entity_ids.push_back(id);
+      entity_records[id] = {&arch, first + i};
+      ids.push_back(id);
+    }
+
+    assign_render_slots(arch, first);
+
+    return first;
+  }
+
   void swap_remove(ArchetypeStorage &arch, EntityId id, size_t row) {
     size_t last_row = arch.entity_ids.size() - 1;
     EntityId last_id = arch.entity_ids[last_row];
@@ -241,6 +860,7 @@ private:
         std::copy(col.data.begin() + last_row * col.stride,
                   col.data.begin() + last_row * col.stride + col.stride,
                   col.data.begin() + row * col.stride);
+        col.touch(row, m_change_tick);
       }
       col.data.resize(col.data.size() - col.stride);
     }
@@ -289,31 +909,67 @@ template <typename... Ts> struct EntityBuilder {
         std::tuple_cat(m_components, std::make_tuple(component)));
   }
 
+  static constexpr bool has_tag =
+      (std::is_same_v<Ts, ObjectTagComponent> || ...) ||
+      (std::is_same_v<Ts, CameraTagComponent> || ...);
+
+  static constexpr bool has_mesh = (std::is_same_v<Ts, MeshComponent> || ...);
+
   EntityId spawn() {
     EntityId id = m_world.spawn();
 
+    RenderSlotComponent slot{};
+    if constexpr (has_mesh)
+      slot.slot = m_world.uniforms.allocate();
+
+    std::apply(
+        [&](auto... components) { m_world.add_components(id, components...); },
+        row_components(slot));
+
+    return id;
+  }
+
+  // Captures the builder's components as a one-row prefab instead of
+  // spawning an entity. Render slots are handed out per instance.
+  Prefab build_prefab() {
+    Prefab prefab;
+
+    std::apply([&](auto... components) { prefab.add_row(components...); },
+               row_components(RenderSlotComponent{}));
+
+    return prefab;
+  }
+
+private:
+  // Transform, the user's components, then the implicit object tag and
+  // render slot where they apply.
+  auto row_components(RenderSlotComponent slot) const {
+    auto tag = [] {
+      if constexpr (has_tag)
+        return std::tuple<>{};
+      else
+        return std::make_tuple(ObjectTagComponent{});
+    }();
+
+    auto render_slot = [&] {
+      if constexpr (has_mesh)
+        return std::make_tuple(slot);
+      else
+        return std::tuple<>{};
+    }();
+
+    return std::tuple_cat(std::make_tuple(make_transform()), m_components, tag,
+                          render_slot);
+  }
+
+  TransformComponent make_transform() const {
     TransformComponent transform{};
     transform.translate(m_position);
     transform.set_scale(m_scale);
     transform.rotation = m_rotation;
     transform.is_dirty = true;
     transform.recalculate();
-
-    constexpr bool has_tag = (std::is_same_v<Ts, ObjectTagComponent> || ...) ||
-                             (std::is_same_v<Ts, CameraTagComponent> || ...);
-
-    std::apply(
-        [&](auto... components) {
-          if constexpr (has_tag) {
-            m_world.add_components(id, transform, components...);
-          } else {
-            m_world.add_components(id, transform, components...,
-                                   ObjectTagComponent{});
-          }
-        },
-        m_components);
-
-    return id;
+    return transform;
   }
 };
 
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "components.hpp"
+#include "culling.hpp"
+#include "entity.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace zephyr {
+
+struct InstanceBatch {
+  MeshHandle mesh;
+  BlendMode blend = BlendMode::OPAQUE;
+  uint32_t first_instance = 0;
+  uint32_t instance_count = 0;
+  // Squared camera distance of the first instance: the nearest one for
+  // opaque and alpha-tested batches, the farthest one for transparent ones.
+  float depth = 0.0f;
+};
+
+// Groups drawable entities by mesh so each group becomes one instanced draw.
+// The instance list holds each entity's render slot in batch order; the
+// vertex shader maps gl_InstanceIndex to it. The cull list carries the same
+// instances with their bounds for GPU culling. Batches are grouped by blend
+// mode in draw order. Opaque and alpha-tested batches, and the instances
+// inside them, come out front to back from `camera_position` so early depth
+// rejection can skip hidden fragments; transparent ones come out back to
+// front so they blend correctly. Entities without a MaterialComponent use
+// `default_blend`. Opaque entities tagged as occluders are also batched on
+// their own for the depth pre-pass. With `occlusion` (anything with an
+// `occludes(center, radius)` test, like OcclusionDepth or
+// OcclusionRasterizer), entities it hides are left out entirely. Storage is
+// reused across frames.
+class InstanceBatcher {
+public:
+  template <typename Occlusion = OcclusionDepth>
+  void build(World &world, glm::vec3 camera_position,
+             BlendMode default_blend = BlendMode::OPAQUE,
+             const Occlusion *occlusion = nullptr) {
+    m_entries.clear();
+    m_groups.clear();
+    m_batches.clear();
+    m_instances.clear();
+    m_cull_instances.clear();
+    m_occluder_entries.clear();
+    m_occluder_batches.clear();
+    m_occluder_instances.clear();
+    m_occluded_count = 0;
+
+    world.query<MeshComponent, RenderSlotComponent, TransformComponent>(
+        [&](EntityId, const MeshComponent &mesh,
+            const RenderSlotComponent &render_slot,
+            const TransformComponent &transform,
+            const MaterialComponent *material,
+            const OccluderTagComponent *occluder) {
+          BlendMode blend = material ? material->blend : default_blend;
+          glm::vec3 offset = glm::vec3(transform.matrix[3]) - camera_position;
+          float depth = glm::dot(offset, offset);
+
+          Entry entry{};
+          entry.key = key(mesh.mesh);
+          entry.mesh = mesh.mesh;
+          entry.slot = render_slot.slot;
+          entry.blend = blend;
+          entry.depth = depth;
+          entry.order = blend == BlendMode::TRANSPARENT ? -depth : depth;
+
+          if (occluder && blend == BlendMode::OPAQUE)
+            m_occluder_entries.push_back(entry);
+
+          if (occlusion) {
+            glm::vec4 sphere =
+                world_sphere(transform.matrix, mesh.mesh.bounds);
+
+            if (occlusion->occludes(glm::vec3(sphere), sphere.w)) {
+              m_occluded_count++;
+              return;
+            }
+          }
+
+          m_entries.push_back(entry);
+        },
+        With<ObjectTagComponent>{}, Optional<MaterialComponent>{},
+        Optional<OccluderTagComponent>{});
+
+    std::sort(m_entries.begin(), m_entries.end(),
+              [](const Entry &a, const Entry &b) {
+                if (a.blend != b.blend)
+                  return a.blend < b.blend;
+                if (a.key != b.key)
+                  return a.key < b.key;
+                if (a.order != b.order)
+                  return a.order < b.order;
+                return a.slot < b.slot;
+              });
+
+    for (uint32_t i = 0; i < m_entries.size(); i++) {
+      if (m_groups.empty() ||
+          !same_group(m_entries[m_groups.back().first], m_entries[i]))
+        m_groups.push_back({i, 0});
+
+      m_groups.back().count++;
+    }
+
+    // A group's first entry is the one that decides its place. Ties keep
+    // mesh order through the entry index, so this needs no stable_sort and
+    // its temporary buffer.
+    std::sort(m_groups.begin(), m_groups.end(),
+              [&](const Group &a, const Group &b) {
+                const Entry &first_a = m_entries[a.first];
+                const Entry &first_b = m_entries[b.first];
+
+                if (first_a.blend != first_b.blend)
+                  return first_a.blend < first_b.blend;
+                if (first_a.order != first_b.order)
+                  return first_a.order < first_b.order;
+                return a.first < b.first;
+              });
+
+    for (auto &group : m_groups) {
+      InstanceBatch batch{};
+      batch.mesh = m_entries[group.first].mesh;
+      batch.blend = m_entries[group.first].blend;
+      batch.first_instance = static_cast<uint32_t>(m_instances.size());
+      batch.instance_count = group.count;
+      batch.depth = m_entries[group.first].depth;
+      m_batches.push_back(batch);
+
+      for (uint32_t i = group.first; i < group.first + group.count; i++) {
+        m_instances.push_back(m_entries[i].slot);
+
+        CullInstance cull{};
+        cull.bounds = m_entries[i].mesh.bounds;
+        cull.slot = m_entries[i].slot;
+        cull.batch = static_cast<uint32_t>(m_batches.size() - 1);
+        m_cull_instances.push_back(cull);
+      }
+    }
+
+    build_occluders();
+
+    REPORT_METRIC("renderer", "instance_batches", m_batches.size());
+    REPORT_METRIC("culling", "cpu_occlusion_culled", m_occluded_count);
+  }
+
+  const std::vector<InstanceBatch> &batches() const { return m_batches; }
+  const std::vector<uint32_t> &instances() const { return m_instances; }
+  const std::vector<CullInstance> &cull_instances() const {
+    return m_cull_instances;
+  }
+
+  // Occluder batches index into occluder_instances(), not instances().
+  const std::vector<InstanceBatch> &occluder_batches() const {
+    return m_occluder_batches;
+  }
+  const std::vector<uint32_t> &occluder_instances() const {
+    return m_occluder_instances;
+  }
+
+  size_t occluded_count() const { return m_occluded_count; }
+
+private:
+  struct Entry {
+    uint64_t key;
+    MeshHandle mesh;
+    uint32_t slot;
+    BlendMode blend;
+    float depth;
+    // Depth negated for transparent entries, so ascending order is the draw
+    // order for every mode.
+    float order;
+  };
+
+  struct Group {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  static uint64_t key(MeshHandle mesh) {
+    return (static_cast<uint64_t>(mesh.first_index) << 32) |
+           static_cast<uint32_t>(mesh.vertex_offset);
+  }
+
+  static bool same_group(const Entry &a, const Entry &b) {
+    return a.blend == b.blend && a.key == b.key;
+  }
+
+  // Occluders only write depth, so batches just follow mesh order.
+  void build_occluders() {
+    std::sort(m_occluder_entries.begin(), m_occluder_entries.end(),
+              [](const Entry &a, const Entry &b) {
+                if (a.key != b.key)
+                  return a.key < b.key;
+                return a.order < b.order;
+              });
+
+    for (auto &entry : m_occluder_entries) {
+      if (m_occluder_batches.empty() ||
+          key(m_occluder_batches.back().mesh) != entry.key) {
+        InstanceBatch batch{};
+        batch.mesh = entry.mesh;
+        batch.first_instance =
+            static_cast<uint32_t>(m_occluder_instances.size());
+        batch.depth = entry.depth;
+        m_occluder_batches.push_back(batch);
+      }
+
+      m_occluder_batches.back().instance_count++;
+      m_occluder_instances.push_back(entry.slot);
+    }
+  }
+
+  std::vector<Entry> m_entries;
+  std::vector<Group> m_groups;
+  std::vector<InstanceBatch> m_batches;
+  std::vector<uint32_t> m_instances;
+  std::vector<CullInstance> m_cull_instances;
+
+  std::vector<Entry> m_occluder_entries;
+  std::vector<InstanceBatch> m_occluder_batches;
+  std::vector<uint32_t> m_occluder_instances;
+  size_t m_occluded_count = 0;
+};
+
+} // namespace zephyr
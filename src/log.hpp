@@ -2,6 +2,7 @@
 
 #include <chrono>
 #include <cstddef>
+#include <iomanip>
 #include <iostream>
 #include <unordered_map>
 #include <vector>
@@ -14,6 +15,7 @@
 #include <ctime>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 namespace zephyr {
 
@@ -161,6 +163,8 @@ inline const char *metric_visualization_to_string(MetricVisualization viz) {
   }
 }
 
+// Categories and keys are views so reporting from the frame loop doesn't
+// build a std::string per call.
 class MetricReporter {
 public:
   static MetricReporter &get() {
@@ -169,7 +173,7 @@ public:
   }
 
   template <typename T>
-  void send(const std::string &category, const std::string &key, T value) {
+  void send(std::string_view category, std::string_view key, T value) {
 #ifdef LOG_IGNIS_METRICS
     std::cout << "[IGNIS_METRIC] " << category << ":" << key << "=" << value
               << std::endl;
@@ -177,7 +181,7 @@ public:
   }
 
   template <typename T>
-  void send_typed(const std::string &category, const std::string &key, T value,
+  void send_typed(std::string_view category, std::string_view key, T value,
                   MetricVisualization viz) {
 #ifdef LOG_IGNIS_METRICS
     std::cout << "[IGNIS_METRIC] " << category << ":" << key << "=" << value
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace zephyr {
+
+// How a material's alpha is resolved. The order is also the draw order:
+// opaque first, then alpha-tested, then blended draws back to front.
+enum class BlendMode : uint8_t { OPAQUE = 0, ALPHA_TESTED = 1, TRANSPARENT = 2 };
+
+inline const char *blend_mode_name(BlendMode mode) {
+  switch (mode) {
+  case BlendMode::ALPHA_TESTED:
+    return "alpha-tested";
+  case BlendMode::TRANSPARENT:
+    return "transparent";
+  default:
+    return "opaque";
+  }
+}
+
+// Picks the cheapest mode that renders an RGBA8 image correctly. Fully
+// opaque images need no blending, and images whose alpha is only ever 0 or
+// 255 can be cut out with a discard while keeping depth writes.
+inline BlendMode classify_alpha(const uint8_t *rgba, size_t pixel_count) {
+  BlendMode mode = BlendMode::OPAQUE;
+
+  for (size_t i = 0; i < pixel_count; i++) {
+    uint8_t alpha = rgba[i * 4 + 3];
+
+    if (alpha == 0)
+      mode = BlendMode::ALPHA_TESTED;
+    else if (alpha != 255)
+      return BlendMode::TRANSPARENT;
+  }
+
+  return mode;
+}
+
+} // namespace zephyr
@@ -46,6 +46,17 @@ struct Vertex {
   }
 };
 
+// Location of a mesh inside the renderer's shared vertex and index buffers.
+// Handles don't own the asset: the registry holds it, and since it only
+// ever appends, a handle stays valid for the registry's whole lifetime.
+struct MeshHandle {
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+  int32_t vertex_offset = 0;
+  // Local bounding sphere, centre in xyz and radius in w.
+  glm::vec4 bounds{0.0f};
+};
+
 class Mesh {
 public:
   std::vector<Vertex> vertices;
@@ -62,6 +73,29 @@ public:
     vertices = p_vertices;
   }
 
+  // Sphere around the vertex AABB. Loose, but cheap and good enough for
+  // frustum tests.
+  glm::vec4 bounding_sphere() const {
+    if (vertices.empty())
+      return glm::vec4(0.0f);
+
+    glm::vec3 min = vertices[0].position;
+    glm::vec3 max = vertices[0].position;
+
+    for (auto &vertex : vertices) {
+      min = glm::min(min, vertex.position);
+      max = glm::max(max, vertex.position);
+    }
+
+    glm::vec3 center = (min + max) * 0.5f;
+    float radius = 0.0f;
+
+    for (auto &vertex : vertices)
+      radius = glm::max(radius, glm::length(vertex.position - center));
+
+    return glm::vec4(center, radius);
+  }
+
   static Mesh capsule(float radius = 0.5f, float height = 1.0f,
                       int segments = 16, int rings = 8);
 
@@ -244,4 +278,13 @@ public:
 
   ~Mesh() = default;
 };
+
+// Geometry is immutable once created and shared by reference; entities only
+// hold the MeshHandle returned when the asset is registered.
+using MeshAsset = Ref<const Mesh>;
+
+inline MeshAsset make_mesh_asset(Mesh mesh) {
+  return create_ref<const Mesh>(std::move(mesh));
+}
+
 } // namespace zephyr
@@ -0,0 +1,375 @@
+#pragma once
+
+#include "components.hpp"
+#include "culling.hpp"
+#include "entity.hpp"
+#include "log.hpp"
+#include "mesh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ZEPH_OCCLUSION_AVX2
+#endif
+
+namespace zephyr {
+
+// Rasterizes occluder meshes into a small depth buffer on the CPU, so
+// objects can be rejected before anything is submitted and without waiting
+// on the GPU. Entities tagged with OccluderTagComponent are drawn when their
+// mesh was registered with add_mesh(). The buffer is split into 8x4 pixel
+// tiles, stored row by row so one AVX2 register holds a tile row, and each
+// tile keeps the farthest depth it holds so most object tests never touch
+// pixels. Without AVX2 the same rows are walked one pixel at a time.
+//
+// Depth is Vulkan's [0, 1] with 1 at the far plane. Triangles that reach
+// behind the near plane are skipped rather than clipped, which only loses
+// occlusion.
+class OcclusionRasterizer {
+public:
+  static constexpr uint32_t TILE_WIDTH = 8;
+  static constexpr uint32_t TILE_HEIGHT = 4;
+  static constexpr uint32_t TILE_SIZE = TILE_WIDTH * TILE_HEIGHT;
+
+  OcclusionRasterizer(uint32_t width = 256, uint32_t height = 144) {
+    resize(width, height);
+
+#ifdef ZEPH_OCCLUSION_AVX2
+    m_use_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+  }
+
+  // Rounds up to whole tiles.
+  void resize(uint32_t width, uint32_t height) {
+    m_tiles_x = std::max((width + TILE_WIDTH - 1) / TILE_WIDTH, 1u);
+    m_tiles_y = std::max((height + TILE_HEIGHT - 1) / TILE_HEIGHT, 1u);
+    m_width = m_tiles_x * TILE_WIDTH;
+    m_height = m_tiles_y * TILE_HEIGHT;
+
+    m_depth.assign(m_tiles_x * m_tiles_y * TILE_SIZE, 1.0f);
+    m_tile_max.assign(m_tiles_x * m_tiles_y, 1.0f);
+  }
+
+  void add_mesh(MeshHandle handle, MeshAsset mesh) {
+    m_meshes[key(handle)] = std::move(mesh);
+  }
+
+  // Lets a caller force the scalar path, e.g. to compare both.
+  void set_simd(bool enabled) {
+#ifdef ZEPH_OCCLUSION_AVX2
+    m_use_avx2 = enabled && __builtin_cpu_supports("avx2") &&
+                 __builtin_cpu_supports("fma");
+#else
+    (void)enabled;
+#endif
+  }
+
+  bool simd() const { return m_use_avx2; }
+
+  void clear() {
+    std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+    std::fill(m_tile_max.begin(), m_tile_max.end(), 1.0f);
+    m_triangle_count = 0;
+    m_occluder_count = 0;
+  }
+
+  // Clears the buffer and draws every tagged occluder seen from
+  // `view_projection`.
+  void render(World &world, const glm::mat4 &view_projection) {
+    clear();
+    m_view_projection = view_projection;
+
+    if (m_meshes.empty())
+      return;
+
+    world.query<MeshComponent, TransformComponent>(
+        [&](EntityId, const MeshComponent &mesh,
+            const TransformComponent &transform) {
+          auto it = m_meshes.find(key(mesh.mesh));
+          if (it == m_meshes.end())
+            return;
+
+          draw_mesh(*it->second, view_projection * transform.matrix);
+        },
+        With<OccluderTagComponent>{});
+
+    REPORT_METRIC("culling", "occluders_rasterized", m_occluder_count);
+    REPORT_METRIC("culling", "occluder_triangles", m_triangle_count);
+  }
+
+  // Draws one mesh already transformed by `model_view_projection`.
+  void draw_mesh(const Mesh &mesh, const glm::mat4 &model_view_projection) {
+    m_clip.resize(mesh.vertices.size());
+
+    for (size_t i = 0; i < mesh.vertices.size(); i++)
+      m_clip[i] =
+          model_view_projection * glm::vec4(mesh.vertices[i].position, 1.0f);
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+      draw_triangle(m_clip[mesh.indices[i]], m_clip[mesh.indices[i + 1]],
+                    m_clip[mesh.indices[i + 2]]);
+
+    m_occluder_count++;
+  }
+
+  // Same contract as OcclusionDepth::occludes(): true only when the sphere's
+  // box is fully on screen and its nearest depth is behind every pixel under
+  // it.
+  bool occludes(glm::vec3 center, float radius) const {
+    if (m_occluder_count == 0)
+      return false;
+
+    ScreenRect rect;
+    if (!project_sphere(m_view_projection, center, radius, rect))
+      return false;
+
+    if (rect.min.x < 0.0f || rect.min.y < 0.0f || rect.max.x > 1.0f ||
+        rect.max.y > 1.0f)
+      return false;
+
+    uint32_t x0 = std::min(static_cast<uint32_t>(rect.min.x * m_width),
+                           m_width - 1);
+    uint32_t y0 = std::min(static_cast<uint32_t>(rect.min.y * m_height),
+                           m_height - 1);
+    uint32_t x1 = std::min(static_cast<uint32_t>(rect.max.x * m_width),
+                           m_width - 1);
+    uint32_t y1 = std::min(static_cast<uint32_t>(rect.max.y * m_height),
+                           m_height - 1);
+
+    for (uint32_t ty = y0 / TILE_HEIGHT; ty <= y1 / TILE_HEIGHT; ty++) {
+      for (uint32_t tx = x0 / TILE_WIDTH; tx <= x1 / TILE_WIDTH; tx++) {
+        uint32_t tile = ty * m_tiles_x + tx;
+
+        if (rect.depth > m_tile_max[tile])
+          continue;
+
+        // The tile holds something at least as far as the object; only
+        // the pixels under the rectangle decide.
+        const float *pixels = &m_depth[tile * TILE_SIZE];
+
+        for (uint32_t y = std::max(y0, ty * TILE_HEIGHT);
+             y <= std::min(y1, ty * TILE_HEIGHT + TILE_HEIGHT - 1); y++) {
+          for (uint32_t x = std::max(x0, tx * TILE_WIDTH);
+               x <= std::min(x1, tx * TILE_WIDTH + TILE_WIDTH - 1); x++) {
+            if (rect.depth <= pixels[(y % TILE_HEIGHT) * TILE_WIDTH +
+                                     x % TILE_WIDTH])
+              return false;
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+  uint32_t width() const { return m_width; }
+  uint32_t height() const { return m_height; }
+  size_t occluder_count() const { return m_occluder_count; }
+  size_t triangle_count() const { return m_triangle_count; }
+
+  float depth_at(uint32_t x, uint32_t y) const {
+    uint32_t tile = (y / TILE_HEIGHT) * m_tiles_x + x / TILE_WIDTH;
+    return m_depth[tile * TILE_SIZE + (y % TILE_HEIGHT) * TILE_WIDTH +
+                   x % TILE_WIDTH];
+  }
+
+private:
+  // Edge functions and depth as planes over pixel coordinates: a pixel is
+  // covered when all three edges are non-negative at its centre.
+  struct Triangle {
+    float edge_a[3];
+    float edge_b[3];
+    float edge_c[3];
+    float depth_a;
+    float depth_b;
+    float depth_c;
+  };
+
+  static uint64_t key(MeshHandle mesh) {
+    return (static_cast<uint64_t>(mesh.first_index) << 32) |
+           static_cast<uint32_t>(mesh.vertex_offset);
+  }
+
+  void draw_triangle(glm::vec4 a, glm::vec4 b, glm::vec4 c) {
+    constexpr float MIN_W = 1e-5f;
+
+    if (a.w < MIN_W || b.w < MIN_W || c.w < MIN_W)
+      return;
+
+    glm::vec3 v[3] = {to_screen(a), to_screen(b), to_screen(c)};
+
+    if (v[0].z < 0.0f || v[1].z < 0.0f || v[2].z < 0.0f)
+      return;
+
+    float area = edge(v[0], v[1], v[2].x, v[2].y);
+    if (std::abs(area) < 1e-8f)
+      return;
+
+    // Occluders are treated as two-sided, so flip clockwise triangles.
+    if (area < 0.0f) {
+      std::swap(v[1], v[2]);
+      area = -area;
+    }
+
+    float min_x = std::min({v[0].x, v[1].x, v[2].x});
+    float max_x = std::max({v[0].x, v[1].x, v[2].x});
+    float min_y = std::min({v[0].y, v[1].y, v[2].y});
+    float max_y = std::max({v[0].y, v[1].y, v[2].y});
+
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= m_width || min_y >= m_height)
+      return;
+
+    Triangle triangle;
+
+    // Edge i lies opposite vertex i, so its value there is the area.
+    for (int i = 0; i < 3; i++) {
+      glm::vec3 from = v[(i + 1) % 3];
+      glm::vec3 to = v[(i + 2) % 3];
+
+      triangle.edge_a[i] = from.y - to.y;
+      triangle.edge_b[i] = to.x - from.x;
+      triangle.edge_c[i] = from.x * to.y - from.y * to.x;
+    }
+
+    triangle.depth_a = triangle.depth_b = triangle.depth_c = 0.0f;
+
+    for (int i = 0; i < 3; i++) {
+      float weight = v[i].z / area;
+      triangle.depth_a += triangle.edge_a[i] * weight;
+      triangle.depth_b += triangle.edge_b[i] * weight;
+      triangle.depth_c += triangle.edge_c[i] * weight;
+    }
+
+    uint32_t tx0 = static_cast<uint32_t>(std::max(min_x, 0.0f)) / TILE_WIDTH;
+    uint32_t ty0 = static_cast<uint32_t>(std::max(min_y, 0.0f)) / TILE_HEIGHT;
+    uint32_t tx1 = std::min(static_cast<uint32_t>(max_x) / TILE_WIDTH,
+                            m_tiles_x - 1);
+    uint32_t ty1 = std::min(static_cast<uint32_t>(max_y) / TILE_HEIGHT,
+                            m_tiles_y - 1);
+
+    for (uint32_t ty = ty0; ty <= ty1; ty++) {
+      for (uint32_t tx = tx0; tx <= tx1; tx++) {
+        uint32_t tile = ty * m_tiles_x + tx;
+        float *pixels = &m_depth[tile * TILE_SIZE];
+        float tile_max = 0.0f;
+
+        for (uint32_t row = 0; row < TILE_HEIGHT; row++) {
+          float x = static_cast<float>(tx * TILE_WIDTH);
+          float y = static_cast<float>(ty * TILE_HEIGHT + row);
+
+#ifdef ZEPH_OCCLUSION_AVX2
+          if (m_use_avx2) {
+            tile_max = std::max(
+                tile_max, draw_row_avx2(pixels + row * TILE_WIDTH, x, y,
+                                        triangle));
+            continue;
+          }
+#endif
+          tile_max = std::max(
+              tile_max, draw_row(pixels + row * TILE_WIDTH, x, y, triangle));
+        }
+
+        m_tile_max[tile] = tile_max;
+      }
+    }
+
+    m_triangle_count++;
+  }
+
+  glm::vec3 to_screen(glm::vec4 clip) const {
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+
+    return glm::vec3((ndc.x * 0.5f + 0.5f) * m_width,
+                     (ndc.y * 0.5f + 0.5f) * m_height, ndc.z);
+  }
+
+  static float edge(glm::vec3 from, glm::vec3 to, float x, float y) {
+    return (to.x - from.x) * (y - from.y) - (to.y - from.y) * (x - from.x);
+  }
+
+  // Writes the nearer depth into covered pixels of one tile row and returns
+  // the row's farthest depth afterwards.
+  static float draw_row(float *row, float x, float y,
+                        const Triangle &triangle) {
+    float row_max = 0.0f;
+    float center_y = y + 0.5f;
+
+    for (uint32_t i = 0; i < TILE_WIDTH; i++) {
+      float center_x = x + i + 0.5f;
+      bool inside = true;
+
+      for (int e = 0; e < 3; e++)
+        inside &= triangle.edge_a[e] * center_x +
+                      triangle.edge_b[e] * center_y + triangle.edge_c[e] >=
+                  0.0f;
+
+      if (inside) {
+        float depth = triangle.depth_a * center_x +
+                      triangle.depth_b * center_y + triangle.depth_c;
+        row[i] = std::min(row[i], depth);
+      }
+
+      row_max = std::max(row_max, row[i]);
+    }
+
+    return row_max;
+  }
+
+#ifdef ZEPH_OCCLUSION_AVX2
+  __attribute__((target("avx2,fma"))) static float
+  draw_row_avx2(float *row, float x, float y, const Triangle &triangle) {
+    __m256 center_x = _mm256_add_ps(
+        _mm256_set1_ps(x),
+        _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f));
+    __m256 center_y = _mm256_set1_ps(y + 0.5f);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+    for (int e = 0; e < 3; e++) {
+      __m256 value = _mm256_fmadd_ps(
+          _mm256_set1_ps(triangle.edge_a[e]), center_x,
+          _mm256_fmadd_ps(_mm256_set1_ps(triangle.edge_b[e]), center_y,
+                          _mm256_set1_ps(triangle.edge_c[e])));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(value, zero, _CMP_GE_OQ));
+    }
+
+    __m256 depth = _mm256_fmadd_ps(
+        _mm256_set1_ps(triangle.depth_a), center_x,
+        _mm256_fmadd_ps(_mm256_set1_ps(triangle.depth_b), center_y,
+                        _mm256_set1_ps(triangle.depth_c)));
+
+    __m256 old_depth = _mm256_loadu_ps(row);
+    __m256 new_depth = _mm256_blendv_ps(
+        old_depth, _mm256_min_ps(old_depth, depth), inside);
+    _mm256_storeu_ps(row, new_depth);
+
+    __m128 half = _mm_max_ps(_mm256_castps256_ps128(new_depth),
+                             _mm256_extractf128_ps(new_depth, 1));
+    half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_max_ss(half, _mm_shuffle_ps(half, half, 1));
+
+    return _mm_cvtss_f32(half);
+  }
+#endif
+
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+  uint32_t m_tiles_x = 0;
+  uint32_t m_tiles_y = 0;
+  bool m_use_avx2 = false;
+
+  std::vector<float> m_depth;
+  std::vector<float> m_tile_max;
+  std::vector<glm::vec4> m_clip;
+  glm::mat4 m_view_projection{1.0f};
+
+  std::unordered_map<uint64_t, MeshAsset> m_meshes;
+  size_t m_occluder_count = 0;
+  size_t m_triangle_count = 0;
+};
+
+} // namespace zephyr
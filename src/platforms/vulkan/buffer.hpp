@@ -149,6 +149,18 @@ struct TransientStagingRegion {
       vkFlushMappedMemoryRanges(ld_handle, 1, &range);
     }
   }
+
+  void invalidate(VkDeviceSize invalidate_offset,
+                  VkDeviceSize invalidate_size = VK_WHOLE_SIZE) {
+    if (mapped) {
+      VkMappedMemoryRange range{};
+      range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      range.memory = memory;
+      range.offset = invalidate_offset;
+      range.size = invalidate_size;
+      vkInvalidateMappedMemoryRanges(ld_handle, 1, &range);
+    }
+  }
 };
 
 struct DeviceLocalRegion {
@@ -11,12 +11,13 @@ public:
   VkCommandBuffer handle = VK_NULL_HANDLE;
   VkDevice ld_handle = VK_NULL_HANDLE;
 
-  static VkCommandBufferAllocateInfo
-  declare_allocate(uint32_t command_buffer_count, VkCommandPool command_pool) {
+  static VkCommandBufferAllocateInfo declare_allocate(
+      uint32_t command_buffer_count, VkCommandPool command_pool,
+      VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
     VkCommandBufferAllocateInfo allocate_info{};
 
     allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.level = level;
     allocate_info.commandPool = command_pool;
     allocate_info.commandBufferCount = command_buffer_count;
 
@@ -46,6 +47,20 @@ public:
                 "Couldn't begin to push command buffer");
   }
 
+  // Secondary buffers executed inside a render pass have to name the pass
+  // they continue.
+  static void begin_secondary_command_buffer(
+      VkCommandBuffer command_buffer,
+      const VkCommandBufferInheritanceInfo &inheritance) {
+    VkCommandBufferBeginInfo begin_info = VulkanCommandBuffer::declare_begin(
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+    begin_info.pInheritanceInfo = &inheritance;
+
+    ZEPH_ENSURE(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS,
+                "Couldn't begin secondary command buffer");
+  }
+
   static void end_command_buffer(VkCommandBuffer command_buffer) {
     ZEPH_ENSURE(vkEndCommandBuffer(command_buffer) != VK_SUCCESS,
                 "Couldn't create shader");
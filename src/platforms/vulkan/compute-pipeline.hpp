@@ -0,0 +1,138 @@
+#pragma once
+
+#include "file.hpp"
+#include "platforms/vulkan/descriptor-set.hpp"
+#include "platforms/vulkan/device.hpp"
+#include "platforms/vulkan/pipeline-cache.hpp"
+#include "platforms/vulkan/shader.hpp"
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+class VulkanComputePipeline {
+public:
+  struct Config {
+    std::string comp_path;
+    uint32_t push_constant_size = 0;
+  };
+
+  VulkanComputePipeline() = default;
+  VulkanComputePipeline(VkDevice ld_handle, VkPipeline handle,
+                        VkPipelineLayout pipeline_layout)
+      : m_handle(handle), m_ld_handle(ld_handle),
+        m_pipeline_layout(pipeline_layout) {}
+
+  static VulkanComputePipeline
+  create(VulkanLogicalDevice logical_device,
+         VulkanDescriptorSetLayout descriptor_set_layout, Config config,
+         VulkanPipelineCache *cache = nullptr) {
+    VkDescriptorSetLayout set_layout = descriptor_set_layout.handle();
+
+    std::vector<char> compute =
+        cache ? cache->shader(config.comp_path) : read_file(config.comp_path);
+
+    uint64_t key = PipelineHasher{}
+                       .add(compute)
+                       .add(config.push_constant_size)
+                       .add(set_layout)
+                       .value;
+
+    if (cache) {
+      if (VkPipeline cached = cache->find(key); cached != VK_NULL_HANDLE) {
+        VulkanComputePipeline pipeline(
+            logical_device.handle, cached,
+            cache->layout({&set_layout, 1}, VK_SHADER_STAGE_COMPUTE_BIT,
+                          config.push_constant_size));
+        pipeline.m_cached = true;
+        return pipeline;
+      }
+    }
+
+    VkShaderModule compute_module =
+        Shader::create_module(logical_device, compute);
+
+    VkPipelineShaderStageCreateInfo compute_stage{};
+    compute_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compute_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compute_stage.module = compute_module;
+    compute_stage.pName = "main";
+
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = config.push_constant_size;
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &set_layout;
+    pipeline_layout_info.pushConstantRangeCount =
+        config.push_constant_size > 0 ? 1 : 0;
+    pipeline_layout_info.pPushConstantRanges =
+        config.push_constant_size > 0 ? &push_constant_range : nullptr;
+
+    VkPipelineLayout pipeline_layout;
+
+    if (cache) {
+      pipeline_layout =
+          cache->layout({&set_layout, 1}, VK_SHADER_STAGE_COMPUTE_BIT,
+                        config.push_constant_size);
+    } else {
+      ZEPH_ENSURE(vkCreatePipelineLayout(logical_device.handle,
+                                         &pipeline_layout_info, nullptr,
+                                         &pipeline_layout) != VK_SUCCESS,
+                  "Couldn't create compute pipeline layout");
+    }
+
+    VkComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage = compute_stage;
+    pipeline_info.layout = pipeline_layout;
+
+    VkPipeline handle;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    if (cache)
+      pipeline_cache = cache->handle();
+
+    ZEPH_ENSURE(vkCreateComputePipelines(logical_device.handle, pipeline_cache,
+                                         1, &pipeline_info, nullptr,
+                                         &handle) != VK_SUCCESS,
+                "Couldn't create compute pipeline");
+
+    vkDestroyShaderModule(logical_device.handle, compute_module, nullptr);
+
+    VulkanComputePipeline pipeline(logical_device.handle, handle,
+                                   pipeline_layout);
+
+    if (cache) {
+      pipeline.m_handle = cache->insert(key, handle);
+      pipeline.m_cached = true;
+    }
+
+    return pipeline;
+  }
+
+  void cleanup() {
+    // Pipelines from a cache are shared and destroyed with it.
+    if (m_cached)
+      return;
+
+    vkDestroyPipeline(m_ld_handle, m_handle, nullptr);
+    vkDestroyPipelineLayout(m_ld_handle, m_pipeline_layout, nullptr);
+  }
+
+  inline constexpr VkPipeline handle() const noexcept { return m_handle; }
+  inline constexpr VkPipelineLayout layout() const noexcept {
+    return m_pipeline_layout;
+  }
+
+private:
+  VkPipeline m_handle = VK_NULL_HANDLE;
+  VkDevice m_ld_handle = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
+  bool m_cached = false;
+};
+
+} // namespace zephyr
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "culling.hpp"
+#include "log.hpp"
+#include "platforms/vulkan/compute-pipeline.hpp"
+#include "platforms/vulkan/descriptor-allocator.hpp"
+#include "platforms/vulkan/descriptor-set.hpp"
+#include "platforms/vulkan/device.hpp"
+#include <array>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// Frustum culls every instance on the GPU, then tests what is left against
+// a Hi-Z pyramid when the frame's params enable it. Survivors are appended
+// to their batch with an atomic on the indirect command's instance count, so
+// the instance list and the draw commands come out compacted. Counts of
+// tested and culled instances land in the params block for readback. Only
+// core 1.0 compute features are used, which keeps it working on lavapipe.
+class VulkanCullingPass {
+public:
+  static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+  // Byte ranges inside a frame ring buffer, in binding order.
+  struct Ranges {
+    VkDeviceSize objects = 0;
+    VkDeviceSize instances = 0;
+    VkDeviceSize draws = 0;
+    VkDeviceSize visible = 0;
+    VkDeviceSize params = 0;
+  };
+
+  struct Offsets {
+    VkDeviceSize objects = 0;
+    VkDeviceSize instances = 0;
+    VkDeviceSize draws = 0;
+    VkDeviceSize visible = 0;
+    VkDeviceSize params = 0;
+  };
+
+  void init(VulkanLogicalDevice logical_device, uint32_t frame_count,
+            VulkanDescriptorLayoutCache &layouts,
+            VulkanPipelineCache *cache = nullptr) {
+    m_logical_device = logical_device;
+
+    std::array<VkDescriptorSetLayoutBinding, BUFFER_BINDINGS + 1> bindings{};
+
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    bindings[HIZ_BINDING].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+    m_set_layout = layouts.get(bindings);
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+         frame_count * BUFFER_BINDINGS},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frame_count}};
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = 2;
+    pool_info.pPoolSizes = pool_sizes;
+    pool_info.maxSets = frame_count;
+
+    ZEPH_ENSURE(vkCreateDescriptorPool(logical_device.handle, &pool_info,
+                                       nullptr, &m_pool) != VK_SUCCESS,
+                "Couldn't create culling descriptor pool");
+
+    std::vector<VkDescriptorSetLayout> set_layouts(frame_count,
+                                                   m_set_layout.handle());
+
+    VkDescriptorSetAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = m_pool;
+    allocate_info.descriptorSetCount = frame_count;
+    allocate_info.pSetLayouts = set_layouts.data();
+
+    m_sets.resize(frame_count);
+
+    ZEPH_ENSURE(vkAllocateDescriptorSets(logical_device.handle, &allocate_info,
+                                         m_sets.data()) != VK_SUCCESS,
+                "Couldn't allocate culling descriptor sets");
+
+    m_pipeline = VulkanComputePipeline::create(
+        logical_device, m_set_layout,
+        {.comp_path = "assets/shaders/cull.comp.spv",
+         .push_constant_size = sizeof(PushConstants)},
+        cache);
+  }
+
+  // Points a frame's set at its ring buffer. Called again whenever the
+  // ring buffer of that frame is replaced.
+  void write(uint32_t frame_index, VkBuffer buffer, Ranges ranges) {
+    std::array<VkDeviceSize, BUFFER_BINDINGS> sizes = {
+        ranges.objects, ranges.instances, ranges.draws, ranges.visible,
+        ranges.params};
+
+    std::array<VkDescriptorBufferInfo, BUFFER_BINDINGS> buffer_infos{};
+    std::array<VkWriteDescriptorSet, BUFFER_BINDINGS> descriptor_writes{};
+
+    for (uint32_t i = 0; i < descriptor_writes.size(); i++) {
+      buffer_infos[i].buffer = buffer;
+      buffer_infos[i].offset = 0;
+      buffer_infos[i].range = sizes[i];
+
+      descriptor_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptor_writes[i].dstSet = m_sets[frame_index];
+      descriptor_writes[i].dstBinding = i;
+      descriptor_writes[i].dstArrayElement = 0;
+      descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+      descriptor_writes[i].descriptorType =
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+      descriptor_writes[i].descriptorCount = 1;
+    }
+
+    vkUpdateDescriptorSets(m_logical_device.handle, descriptor_writes.size(),
+                           descriptor_writes.data(), 0, nullptr);
+  }
+
+  // Points every frame's set at the Hi-Z pyramid. Called again whenever the
+  // pyramid is recreated.
+  void write_hiz(VkImageView view, VkSampler sampler) {
+    VkDescriptorImageInfo image_info{};
+    image_info.sampler = sampler;
+    image_info.imageView = view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    for (auto set : m_sets) {
+      VkWriteDescriptorSet descriptor_write{};
+      descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptor_write.dstSet = set;
+      descriptor_write.dstBinding = HIZ_BINDING;
+      descriptor_write.descriptorType =
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptor_write.descriptorCount = 1;
+      descriptor_write.pImageInfo = &image_info;
+
+      vkUpdateDescriptorSets(m_logical_device.handle, 1, &descriptor_write, 0,
+                             nullptr);
+    }
+  }
+
+  // Records the dispatch. Must be outside a render pass; the barrier that
+  // makes its output visible to the draws comes from the frame graph.
+  void record(VkCommandBuffer command_buffer, uint32_t frame_index,
+              Offsets offsets, const CullFrustum &frustum,
+              uint32_t instance_count) {
+    if (instance_count == 0)
+      return;
+
+    PushConstants push{};
+    for (size_t i = 0; i < frustum.planes.size(); i++)
+      push.planes[i] = frustum.planes[i];
+    push.instance_count = instance_count;
+
+    uint32_t dynamic_offsets[] = {static_cast<uint32_t>(offsets.objects),
+                                  static_cast<uint32_t>(offsets.instances),
+                                  static_cast<uint32_t>(offsets.draws),
+                                  static_cast<uint32_t>(offsets.visible),
+                                  static_cast<uint32_t>(offsets.params)};
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      m_pipeline.handle());
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_pipeline.layout(), 0, 1, &m_sets[frame_index],
+                            BUFFER_BINDINGS, dynamic_offsets);
+
+    vkCmdPushConstants(command_buffer, m_pipeline.layout(),
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+    vkCmdDispatch(command_buffer,
+                  (instance_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+    REPORT_METRIC("renderer", "cull_instances", instance_count);
+  }
+
+  void cleanup() {
+    m_pipeline.cleanup();
+    vkDestroyDescriptorPool(m_logical_device.handle, m_pool, nullptr);
+  }
+
+private:
+  static constexpr uint32_t BUFFER_BINDINGS = 5;
+  static constexpr uint32_t HIZ_BINDING = BUFFER_BINDINGS;
+
+  struct PushConstants {
+    glm::vec4 planes[6];
+    uint32_t instance_count;
+  };
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanDescriptorSetLayout m_set_layout;
+  VkDescriptorPool m_pool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> m_sets;
+  VulkanComputePipeline m_pipeline;
+};
+
+} // namespace zephyr
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "assert.hpp"
+#include "log.hpp"
+#include "platforms/vulkan/descriptor-set.hpp"
+#include "platforms/vulkan/device.hpp"
+#include "platforms/vulkan/pipeline-cache.hpp"
+#include <algorithm>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// Dedupes descriptor set layouts by their bindings, so equal layouts share
+// one handle and pipelines keyed on it are shared too. The hash only picks a
+// bucket: each entry keeps its normalized bindings, which are compared on a
+// hit. Layouts stay owned by the cache.
+class VulkanDescriptorLayoutCache {
+public:
+  void init(VulkanLogicalDevice logical_device) {
+    m_logical_device = logical_device;
+  }
+
+  // `binding_flags` is either empty or holds one entry per binding.
+  VulkanDescriptorSetLayout
+  get(std::span<const VkDescriptorSetLayoutBinding> bindings,
+      VkDescriptorSetLayoutCreateFlags flags = 0,
+      std::span<const VkDescriptorBindingFlags> binding_flags = {}) {
+    ZEPH_ENSURE(!binding_flags.empty() &&
+                    binding_flags.size() != bindings.size(),
+                "Binding flags don't match the bindings: ",
+                binding_flags.size(), " for ", bindings.size());
+
+    LayoutKey key = make_key(bindings, flags, binding_flags);
+    uint64_t hash = key.hash();
+
+    auto &bucket = m_layouts[hash];
+    for (auto &entry : bucket) {
+      if (entry.key == key)
+        return VulkanDescriptorSetLayout(entry.handle,
+                                         m_logical_device.handle);
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+    flags_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+    flags_info.pBindingFlags = binding_flags.data();
+
+    VkDescriptorSetLayoutCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    create_info.pNext = binding_flags.empty() ? nullptr : &flags_info;
+    create_info.flags = flags;
+    create_info.bindingCount = static_cast<uint32_t>(bindings.size());
+    create_info.pBindings = bindings.data();
+
+    VkDescriptorSetLayout handle;
+
+    ZEPH_ENSURE(vkCreateDescriptorSetLayout(m_logical_device.handle,
+                                            &create_info, nullptr,
+                                            &handle) != VK_SUCCESS,
+                "Couldn't create descriptor set layout");
+
+    bucket.push_back({std::move(key), handle});
+    return VulkanDescriptorSetLayout(handle, m_logical_device.handle);
+  }
+
+  void cleanup() {
+    for (auto &[hash, bucket] : m_layouts) {
+      for (auto &entry : bucket)
+        vkDestroyDescriptorSetLayout(m_logical_device.handle, entry.handle,
+                                     nullptr);
+    }
+
+    m_layouts.clear();
+  }
+
+private:
+  // Field by field: VkDescriptorSetLayoutBinding has padding and a sampler
+  // pointer, so neither its bytes nor the pointer say what it holds.
+  struct BindingKey {
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stages;
+    VkDescriptorBindingFlags flags;
+    std::vector<VkSampler> immutable_samplers;
+
+    bool operator==(const BindingKey &) const = default;
+  };
+
+  struct LayoutKey {
+    VkDescriptorSetLayoutCreateFlags flags;
+    std::vector<BindingKey> bindings;
+
+    bool operator==(const LayoutKey &) const = default;
+
+    uint64_t hash() const {
+      PipelineHasher hasher;
+      hasher.add(flags);
+
+      for (auto &binding : bindings) {
+        hasher.add(binding.binding)
+            .add(binding.type)
+            .add(binding.count)
+            .add(binding.stages)
+            .add(binding.flags);
+
+        for (auto sampler : binding.immutable_samplers)
+          hasher.add(sampler);
+      }
+
+      return hasher.value;
+    }
+  };
+
+  struct Entry {
+    LayoutKey key;
+    VkDescriptorSetLayout handle;
+  };
+
+  // Sorted by binding number so the order bindings are listed in doesn't
+  // split equal layouts.
+  static LayoutKey
+  make_key(std::span<const VkDescriptorSetLayoutBinding> bindings,
+           VkDescriptorSetLayoutCreateFlags flags,
+           std::span<const VkDescriptorBindingFlags> binding_flags) {
+    LayoutKey key{flags, {}};
+    key.bindings.reserve(bindings.size());
+
+    for (size_t i = 0; i < bindings.size(); i++) {
+      const auto &binding = bindings[i];
+
+      BindingKey &binding_key = key.bindings.emplace_back();
+      binding_key.binding = binding.binding;
+      binding_key.type = binding.descriptorType;
+      binding_key.count = binding.descriptorCount;
+      binding_key.stages = binding.stageFlags;
+      binding_key.flags = binding_flags.empty() ? 0 : binding_flags[i];
+
+      // Immutable samplers only apply to sampler descriptors.
+      bool takes_samplers =
+          binding.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER ||
+          binding.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+      if (takes_samplers && binding.pImmutableSamplers)
+        binding_key.immutable_samplers.assign(
+            binding.pImmutableSamplers,
+            binding.pImmutableSamplers + binding.descriptorCount);
+    }
+
+    std::sort(key.bindings.begin(), key.bindings.end(),
+              [](const BindingKey &a, const BindingKey &b) {
+                return a.binding < b.binding;
+              });
+
+    return key;
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  std::unordered_map<uint64_t, std::vector<Entry>> m_layouts;
+};
+
+// Hands out descriptor sets that live for one frame. Each frame in flight
+// keeps the pools it allocated from; once its fence has signalled,
+// begin_frame() resets them all with vkResetDescriptorPool instead of
+// freeing sets one by one, and they go back on a shared free list. When the
+// current pool runs out, another one is taken from the free list or
+// created, each new pool twice the size of the last up to a cap, so
+// allocation never fails for lack of space.
+class VulkanDescriptorAllocator {
+public:
+  static constexpr uint32_t INITIAL_SETS_PER_POOL = 16;
+  static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+  void init(VulkanLogicalDevice logical_device, uint32_t frame_count) {
+    m_logical_device = logical_device;
+    m_frames.assign(frame_count, {});
+    m_sets_per_pool = INITIAL_SETS_PER_POOL;
+    m_layouts.init(logical_device);
+  }
+
+  // Must be called after `frame_index`'s fence wait: every set handed out
+  // for that frame becomes invalid.
+  void begin_frame(uint32_t frame_index) {
+    m_current = frame_index;
+
+    Frame &frame = m_frames[frame_index];
+
+    for (auto pool : frame.pools) {
+      vkResetDescriptorPool(m_logical_device.handle, pool, 0);
+      m_free_pools.push_back(pool);
+    }
+
+    frame.pools.clear();
+    frame.set_count = 0;
+  }
+
+  VkDescriptorSet allocate(VulkanDescriptorSetLayout &layout) {
+    Frame &frame = m_frames[m_current];
+
+    if (frame.pools.empty())
+      frame.pools.push_back(acquire_pool());
+
+    VkDescriptorSet set;
+    VkResult result = allocate_from(frame.pools.back(), layout, set);
+
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY ||
+        result == VK_ERROR_FRAGMENTED_POOL) {
+      frame.pools.push_back(acquire_pool());
+      result = allocate_from(frame.pools.back(), layout, set);
+    }
+
+    ZEPH_ENSURE(result != VK_SUCCESS, "Couldn't allocate descriptor set");
+
+    frame.set_count++;
+    REPORT_METRIC("renderer", "frame_descriptor_sets", frame.set_count);
+
+    return set;
+  }
+
+  VulkanDescriptorLayoutCache &layouts() { return m_layouts; }
+
+  void cleanup() {
+    for (auto &frame : m_frames) {
+      m_free_pools.insert(m_free_pools.end(), frame.pools.begin(),
+                          frame.pools.end());
+      frame.pools.clear();
+    }
+
+    for (auto pool : m_free_pools)
+      vkDestroyDescriptorPool(m_logical_device.handle, pool, nullptr);
+
+    m_free_pools.clear();
+    m_layouts.cleanup();
+  }
+
+private:
+  struct Frame {
+    std::vector<VkDescriptorPool> pools;
+    size_t set_count = 0;
+  };
+
+  // Descriptors of each type per set. Covers what the renderer's layouts
+  // use with room to spare; a set that doesn't fit fails once and moves on
+  // to a fresh pool.
+  struct PoolRatio {
+    VkDescriptorType type;
+    float per_set;
+  };
+
+  static constexpr PoolRatio POOL_RATIOS[] = {
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2.0f},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f},
+  };
+
+  VkResult allocate_from(VkDescriptorPool pool,
+                         VulkanDescriptorSetLayout &layout,
+                         VkDescriptorSet &set) {
+    VkDescriptorSetAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = pool;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &layout.handle();
+
+    return vkAllocateDescriptorSets(m_logical_device.handle, &allocate_info,
+                                    &set);
+  }
+
+  VkDescriptorPool acquire_pool() {
+    if (!m_free_pools.empty()) {
+      VkDescriptorPool pool = m_free_pools.back();
+      m_free_pools.pop_back();
+      return pool;
+    }
+
+    std::vector<VkDescriptorPoolSize> pool_sizes;
+    for (auto &ratio : POOL_RATIOS)
+      pool_sizes.push_back(
+          {ratio.type, static_cast<uint32_t>(ratio.per_set * m_sets_per_pool)});
+
+    VkDescriptorPoolCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    create_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+    create_info.pPoolSizes = pool_sizes.data();
+    create_info.maxSets = m_sets_per_pool;
+
+    VkDescriptorPool pool;
+
+    ZEPH_ENSURE(vkCreateDescriptorPool(m_logical_device.handle, &create_info,
+                                       nullptr, &pool) != VK_SUCCESS,
+                "Couldn't create descriptor pool");
+
+    m_pool_count++;
+    m_sets_per_pool = std::min(m_sets_per_pool * 2, MAX_SETS_PER_POOL);
+
+    REPORT_METRIC("renderer", "descriptor_pools", m_pool_count);
+
+    return pool;
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanDescriptorLayoutCache m_layouts;
+
+  std::vector<Frame> m_frames;
+  std::vector<VkDescriptorPool> m_free_pools;
+  uint32_t m_current = 0;
+  uint32_t m_sets_per_pool = INITIAL_SETS_PER_POOL;
+  size_t m_pool_count = 0;
+};
+
+} // namespace zephyr
@@ -43,9 +43,25 @@ VulkanLogicalDevice::create(const VulkanPhysicalDevice &physical_device) {
   VkPhysicalDeviceFeatures device_features{};
   device_features.samplerAnisotropy = VK_TRUE;
 
+  // Optional: without these the renderer records indirect draws one by one.
+  device_features.multiDrawIndirect =
+      physical_device.available_features.multiDrawIndirect;
+  device_features.drawIndirectFirstInstance =
+      physical_device.available_features.drawIndirectFirstInstance;
+
+  // Required by the picker, for the bindless texture table.
+  VkPhysicalDeviceDescriptorIndexingFeatures descriptor_indexing{};
+  descriptor_indexing.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+  descriptor_indexing.runtimeDescriptorArray = VK_TRUE;
+  descriptor_indexing.descriptorBindingPartiallyBound = VK_TRUE;
+  descriptor_indexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  descriptor_indexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
   VkDeviceCreateInfo create_info{};
 
   create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  create_info.pNext = &descriptor_indexing;
   create_info.pQueueCreateInfos = queue_create_infos.data();
   create_info.queueCreateInfoCount =
       static_cast<uint32_t>(queue_create_infos.size());
@@ -65,6 +81,7 @@ VulkanLogicalDevice::create(const VulkanPhysicalDevice &physical_device) {
               "Couldn't create logical device")
 
   logical_device.phy_handle = physical_device.handle;
+  logical_device.enabled_features = device_features;
 
   vkGetDeviceQueue(logical_device.handle,
                    physical_device.queue_family_indices.graphics_family.value(),
@@ -16,6 +16,7 @@ struct VulkanPhysicalDevice {
   VkPhysicalDevice handle;
   VkPhysicalDeviceFeatures available_features;
   VkPhysicalDeviceProperties available_properties;
+  VkPhysicalDeviceDescriptorIndexingProperties descriptor_indexing_properties{};
 
   VulkanSwapChainSupport swap_chain_support;
 
@@ -57,6 +58,25 @@ struct VulkanPhysicalDevice {
 
     ZEPH_EXCEPTION("Couldn't find suitable memory type");
   }
+
+  // First depth format, most precise first, usable as an optimally tiled
+  // depth attachment that can also be sampled.
+  static VkFormat find_depth_format(VkPhysicalDevice device_handle) {
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
+                            VK_FORMAT_D24_UNORM_S8_UINT}) {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties(device_handle, format, &properties);
+
+      VkFormatFeatureFlags required =
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
+      if ((properties.optimalTilingFeatures & required) == required)
+        return format;
+    }
+
+    ZEPH_EXCEPTION("Couldn't find a supported depth format");
+  }
 };
 
 struct VulkanPhysicalDevicePicker {
@@ -87,6 +107,10 @@ struct VulkanPhysicalDevicePicker {
       vkGetPhysicalDeviceProperties(device, &device_properties);
       vkGetPhysicalDeviceFeatures(device, &device_features);
 
+      if (device_properties.apiVersion < VK_API_VERSION_1_2 ||
+          !supports_bindless_textures(device))
+        continue;
+
       VulkanQueueFamilyIndices indices =
           VulkanQueueFamilyIndices::find_queue_families(
               surface.handle(), device, VK_QUEUE_GRAPHICS_BIT);
@@ -97,11 +121,14 @@ struct VulkanPhysicalDevicePicker {
       if (VulkanPhysicalDevicePicker::is_suitable_candidate(
               device, indices, swap_chain_support, device_features,
               required_extensions)) {
-        candidates.insert(std::make_pair(
-            rate_suitable_device(device_properties),
-            VulkanPhysicalDevice(indices, device, device_features,
-                                 device_properties, swap_chain_support,
-                                 required_extensions)));
+        VulkanPhysicalDevice candidate(indices, device, device_features,
+                                       device_properties, swap_chain_support,
+                                       required_extensions);
+        candidate.descriptor_indexing_properties =
+            descriptor_indexing_properties(device);
+
+        candidates.insert(
+            std::make_pair(rate_suitable_device(device_properties), candidate));
       }
     }
 
@@ -134,6 +161,40 @@ struct VulkanPhysicalDevicePicker {
     return score;
   }
 
+  // The texture table is a partially bound, update-after-bind array indexed
+  // per draw, which is core in Vulkan 1.2 but optional.
+  static bool supports_bindless_textures(VkPhysicalDevice device) {
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing{};
+    indexing.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &indexing;
+
+    vkGetPhysicalDeviceFeatures2(device, &features);
+
+    return indexing.runtimeDescriptorArray &&
+           indexing.descriptorBindingPartiallyBound &&
+           indexing.descriptorBindingSampledImageUpdateAfterBind &&
+           indexing.shaderSampledImageArrayNonUniformIndexing;
+  }
+
+  static VkPhysicalDeviceDescriptorIndexingProperties
+  descriptor_indexing_properties(VkPhysicalDevice device) {
+    VkPhysicalDeviceDescriptorIndexingProperties indexing{};
+    indexing.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexing;
+
+    vkGetPhysicalDeviceProperties2(device, &properties);
+
+    return indexing;
+  }
+
   static bool ensure_device_extensions_support(
       VkPhysicalDevice device, std::vector<const char *> required_extensions) {
     uint32_t available_extension_count;
@@ -185,6 +246,7 @@ public:
   VulkanQueueFamilyIndices indices;
   VkDevice handle;
   VkPhysicalDevice phy_handle;
+  VkPhysicalDeviceFeatures enabled_features{};
 
   VkQueue graphics_queue;
   VkQueue present_queue;
@@ -0,0 +1,673 @@
+#pragma once
+
+#include "assert.hpp"
+#include "log.hpp"
+#include "platforms/vulkan/device.hpp"
+#include "platforms/vulkan/image.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+using FrameGraphResource = uint32_t;
+
+// How a pass touches a resource. `layout` only matters for images.
+struct FrameGraphAccess {
+  VkPipelineStageFlags stage = 0;
+  VkAccessFlags access = 0;
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+struct FrameGraphImageDesc {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent{};
+  VkImageUsageFlags usage = 0;
+  VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+  bool operator==(const FrameGraphImageDesc &other) const {
+    return format == other.format && extent.width == other.extent.width &&
+           extent.height == other.extent.height && usage == other.usage &&
+           aspect == other.aspect;
+  }
+};
+
+struct FrameGraphStats {
+  size_t pass_count = 0;
+  size_t culled_pass_count = 0;
+  size_t barrier_count = 0;
+  size_t barrier_batch_count = 0;
+  VkDeviceSize transient_bytes = 0;
+  VkDeviceSize aliased_bytes = 0;
+};
+
+// Memory shared by transient images whose lifetimes don't overlap.
+struct FrameGraphMemoryBlock {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  uint32_t type_bits = ~0u;
+  int32_t free_after = -1;
+  int32_t last_resource = -1;
+};
+
+// Greedy interval packing: an image used from `first_pass` to `last_pass`
+// goes into the first block whose previous user is done before it starts and
+// that has a memory type it accepts, or into a new block. Images have to be
+// placed in order of first use. Returns the block's index.
+inline uint32_t place_in_block(std::vector<FrameGraphMemoryBlock> &blocks,
+                               int32_t first_pass, int32_t last_pass,
+                               const VkMemoryRequirements &requirements) {
+  auto block = std::find_if(
+      blocks.begin(), blocks.end(), [&](const FrameGraphMemoryBlock &b) {
+        return b.free_after < first_pass &&
+               (b.type_bits & requirements.memoryTypeBits);
+      });
+
+  if (block == blocks.end())
+    block = blocks.emplace(blocks.end());
+
+  block->size = std::max<VkDeviceSize>(block->size, requirements.size);
+  block->type_bits &= requirements.memoryTypeBits;
+  block->free_after = last_pass;
+
+  return static_cast<uint32_t>(block - blocks.begin());
+}
+
+// A pass's recording callback, stored inline. Passes are declared every
+// frame, and std::function would allocate for captures past a pointer or
+// two. Captures have to fit the buffer and be trivially copyable, which
+// holds for `this` plus a few handles or sizes.
+class PassCallback {
+public:
+  PassCallback() = default;
+
+  template <typename Fn>
+    requires(!std::is_same_v<std::remove_cvref_t<Fn>, PassCallback>)
+  PassCallback(Fn fn) {
+    static_assert(sizeof(Fn) <= CAPACITY && alignof(Fn) <= alignof(Storage),
+                  "Pass callback captures too much");
+    static_assert(std::is_trivially_copyable_v<Fn> &&
+                      std::is_trivially_destructible_v<Fn>,
+                  "Pass callbacks can only capture trivially copyable values");
+
+    new (m_storage.bytes) Fn(fn);
+    m_call = [](void *storage, VkCommandBuffer command_buffer) {
+      (*static_cast<Fn *>(storage))(command_buffer);
+    };
+  }
+
+  void operator()(VkCommandBuffer command_buffer) {
+    m_call(m_storage.bytes, command_buffer);
+  }
+
+private:
+  static constexpr size_t CAPACITY = 48;
+
+  struct Storage {
+    alignas(std::max_align_t) std::byte bytes[CAPACITY];
+  };
+
+  Storage m_storage{};
+  void (*m_call)(void *, VkCommandBuffer) = nullptr;
+};
+
+// Passes are declared every frame together with the resources they read and
+// write. compile() drops passes whose results never reach an output, places
+// transient images whose lifetimes don't overlap in the same memory, and
+// works out one batched barrier per pass from the declared accesses. One
+// graph is kept per frame in flight, so its transient images are only
+// replaced once that frame's fence has been waited on.
+class FrameGraph {
+public:
+  class PassBuilder {
+  public:
+    PassBuilder(FrameGraph &graph, uint32_t pass)
+        : m_graph(graph), m_pass(pass) {}
+
+    PassBuilder &read(FrameGraphResource resource, FrameGraphAccess access) {
+      m_graph.add_use(m_pass, resource, access, false);
+      return *this;
+    }
+
+    PassBuilder &write(FrameGraphResource resource, FrameGraphAccess access) {
+      m_graph.add_use(m_pass, resource, access, true);
+      return *this;
+    }
+
+    // The pass's VkRenderPass moves its attachments into the declared
+    // layouts itself, so the graph only orders memory around it.
+    PassBuilder &render_pass_transitions() {
+      m_graph.m_passes[m_pass].render_pass_transitions = true;
+      return *this;
+    }
+
+    // Keeps the pass even if nothing reads what it writes.
+    PassBuilder &side_effect() {
+      m_graph.m_passes[m_pass].side_effect = true;
+      return *this;
+    }
+
+  private:
+    FrameGraph &m_graph;
+    uint32_t m_pass;
+  };
+
+  void init(VulkanLogicalDevice logical_device,
+            VulkanPhysicalDevice physical_device) {
+    m_logical_device = logical_device;
+    m_physical_device = physical_device;
+  }
+
+  // Starts a new declaration. Storage and transient images are kept.
+  void reset() {
+    m_resources.clear();
+    m_pass_count = 0;
+  }
+
+  FrameGraphResource import_buffer(const char *name, VkBuffer buffer,
+                                   VkDeviceSize offset, VkDeviceSize size) {
+    Resource resource{};
+    resource.name = name;
+    resource.buffer = buffer;
+    resource.offset = offset;
+    resource.size = size;
+
+    return add_resource(resource);
+  }
+
+  // For images that carry data across frames, `previous` is the access of
+  // an earlier frame that this frame's first use has to wait for.
+  FrameGraphResource import_image(const char *name, VkImage image,
+                                  VkImageAspectFlags aspect,
+                                  VkImageLayout initial_layout,
+                                  FrameGraphAccess previous = {}) {
+    Resource resource{};
+    resource.name = name;
+    resource.is_image = true;
+    resource.image = image;
+    resource.desc.aspect = aspect;
+    resource.initial_layout = initial_layout;
+    resource.previous = previous;
+
+    return add_resource(resource);
+  }
+
+  // The image only exists between its first and last use in this frame, and
+  // its contents start undefined.
+  FrameGraphResource create_image(const char *name,
+                                  const FrameGraphImageDesc &desc) {
+    Resource resource{};
+    resource.name = name;
+    resource.is_image = true;
+    resource.transient = true;
+    resource.desc = desc;
+
+    return add_resource(resource);
+  }
+
+  void mark_output(FrameGraphResource resource) {
+    m_resources[resource].output = true;
+  }
+
+  PassBuilder add_pass(const char *name, PassCallback execute) {
+    if (m_pass_count == m_passes.size())
+      m_passes.emplace_back();
+
+    Pass &pass = m_passes[m_pass_count];
+    pass.name = name;
+    pass.execute = execute;
+    pass.uses.clear();
+    pass.render_pass_transitions = false;
+    pass.side_effect = false;
+
+    return PassBuilder(*this, static_cast<uint32_t>(m_pass_count++));
+  }
+
+  void compile() {
+    m_stats = {};
+    m_stats.pass_count = m_pass_count;
+
+    cull_passes();
+    place_transients();
+    build_barriers();
+
+    REPORT_METRIC("frame_graph", "passes", m_stats.pass_count);
+    REPORT_METRIC("frame_graph", "culled_passes", m_stats.culled_pass_count);
+    REPORT_METRIC("frame_graph", "barriers", m_stats.barrier_count);
+    REPORT_METRIC("frame_graph", "barrier_batches", m_stats.barrier_batch_count);
+    REPORT_METRIC("frame_graph", "transient_bytes", m_stats.transient_bytes);
+    REPORT_METRIC("frame_graph", "aliased_bytes", m_stats.aliased_bytes);
+  }
+
+  void execute(VkCommandBuffer command_buffer) {
+    for (size_t i = 0; i < m_pass_count; i++) {
+      Pass &pass = m_passes[i];
+
+      if (!pass.live)
+        continue;
+
+      if (!pass.buffer_barriers.empty() || !pass.image_barriers.empty()) {
+        vkCmdPipelineBarrier(
+            command_buffer, pass.src_stage, pass.dst_stage, 0, 0, nullptr,
+            static_cast<uint32_t>(pass.buffer_barriers.size()),
+            pass.buffer_barriers.data(),
+            static_cast<uint32_t>(pass.image_barriers.size()),
+            pass.image_barriers.data());
+      }
+
+      pass.execute(command_buffer);
+    }
+  }
+
+  VkImage image(FrameGraphResource resource) const {
+    const Resource &r = m_resources[resource];
+    return r.transient ? m_transients[r.transient_index].image : r.image;
+  }
+
+  VkImageView image_view(FrameGraphResource resource) const {
+    const Resource &r = m_resources[resource];
+    if (!r.transient)
+      return VK_NULL_HANDLE;
+
+    return m_transients[r.transient_index].view.handle;
+  }
+
+  const FrameGraphStats &stats() const { return m_stats; }
+
+  void cleanup() { release_transients(); }
+
+private:
+  struct Resource {
+    const char *name = "";
+    bool is_image = false;
+    bool transient = false;
+    bool output = false;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+
+    VkImage image = VK_NULL_HANDLE;
+    VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    FrameGraphAccess previous;
+    FrameGraphImageDesc desc;
+
+    // Filled by compile().
+    int32_t first_pass = -1;
+    int32_t last_pass = -1;
+    uint32_t transient_index = 0;
+    int32_t alias_of = -1;
+  };
+
+  struct Use {
+    FrameGraphResource resource;
+    FrameGraphAccess access;
+    bool reads = false;
+    bool writes = false;
+  };
+
+  struct Pass {
+    const char *name = "";
+    PassCallback execute;
+    std::vector<Use> uses;
+    bool render_pass_transitions = false;
+    bool side_effect = false;
+    bool live = false;
+
+    VkPipelineStageFlags src_stage = 0;
+    VkPipelineStageFlags dst_stage = 0;
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+    std::vector<VkImageMemoryBarrier> image_barriers;
+  };
+
+  // What has touched a resource since its last barrier-relevant write.
+  struct State {
+    VkPipelineStageFlags write_stage = 0;
+    VkAccessFlags write_access = 0;
+    VkPipelineStageFlags read_stages = 0;
+    VkAccessFlags read_access = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  struct TransientImage {
+    FrameGraphImageDesc desc;
+    int32_t first_pass = -1;
+    int32_t last_pass = -1;
+    VkImage image = VK_NULL_HANDLE;
+    VulkanBuffer::VulkanImageView view;
+    VkMemoryRequirements requirements{};
+    uint32_t block = 0;
+  };
+
+  FrameGraphResource add_resource(const Resource &resource) {
+    m_resources.push_back(resource);
+    return static_cast<FrameGraphResource>(m_resources.size() - 1);
+  }
+
+  // Accesses to the same resource within one pass are merged, so each
+  // resource gets at most one barrier per pass.
+  void add_use(uint32_t pass_index, FrameGraphResource resource,
+               FrameGraphAccess access, bool write) {
+    auto &uses = m_passes[pass_index].uses;
+
+    auto it = std::find_if(uses.begin(), uses.end(), [&](const Use &use) {
+      return use.resource == resource;
+    });
+
+    if (it == uses.end()) {
+      uses.push_back({resource, access, !write, write});
+      return;
+    }
+
+    ZEPH_ENSURE(m_resources[resource].is_image &&
+                    it->access.layout != access.layout,
+                "Pass ", m_passes[pass_index].name, " uses ",
+                m_resources[resource].name, " in two layouts");
+
+    it->access.stage |= access.stage;
+    it->access.access |= access.access;
+    it->reads |= !write;
+    it->writes |= write;
+  }
+
+  // Walks the passes backwards from the outputs. A pass survives when it
+  // has side effects or writes something a surviving pass reads.
+  void cull_passes() {
+    m_needed.assign(m_resources.size(), false);
+
+    for (size_t r = 0; r < m_resources.size(); r++)
+      m_needed[r] = m_resources[r].output;
+
+    for (size_t i = m_pass_count; i-- > 0;) {
+      Pass &pass = m_passes[i];
+      pass.live = pass.side_effect;
+
+      for (auto &use : pass.uses)
+        pass.live |= use.writes && m_needed[use.resource];
+
+      if (!pass.live) {
+        m_stats.culled_pass_count++;
+        continue;
+      }
+
+      for (auto &use : pass.uses) {
+        if (use.reads)
+          m_needed[use.resource] = true;
+      }
+    }
+
+    for (size_t i = 0; i < m_pass_count; i++) {
+      if (!m_passes[i].live)
+        continue;
+
+      for (auto &use : m_passes[i].uses) {
+        Resource &resource = m_resources[use.resource];
+        if (resource.first_pass < 0)
+          resource.first_pass = static_cast<int32_t>(i);
+        resource.last_pass = static_cast<int32_t>(i);
+      }
+    }
+  }
+
+  // Transients are packed into memory blocks by place_in_block(). Images
+  // and memory are only recreated when the set of transients or their
+  // lifetimes change.
+  void place_transients() {
+    m_order.clear();
+
+    for (size_t r = 0; r < m_resources.size(); r++) {
+      if (m_resources[r].transient && m_resources[r].first_pass >= 0)
+        m_order.push_back(static_cast<uint32_t>(r));
+    }
+
+    std::sort(m_order.begin(), m_order.end(), [&](uint32_t a, uint32_t b) {
+      return m_resources[a].first_pass < m_resources[b].first_pass;
+    });
+
+    bool changed = m_order.size() != m_transients.size();
+
+    for (size_t i = 0; i < m_order.size() && !changed; i++) {
+      const Resource &resource = m_resources[m_order[i]];
+      const TransientImage &transient = m_transients[i];
+
+      changed = !(transient.desc == resource.desc) ||
+                transient.first_pass != resource.first_pass ||
+                transient.last_pass != resource.last_pass;
+    }
+
+    if (changed)
+      rebuild_transients();
+
+    for (auto &block : m_blocks)
+      block.last_resource = -1;
+
+    for (size_t i = 0; i < m_order.size(); i++) {
+      Resource &resource = m_resources[m_order[i]];
+      FrameGraphMemoryBlock &block = m_blocks[m_transients[i].block];
+
+      resource.transient_index = static_cast<uint32_t>(i);
+      resource.alias_of = block.last_resource;
+      block.last_resource = static_cast<int32_t>(m_order[i]);
+
+      m_stats.transient_bytes += m_transients[i].requirements.size;
+    }
+
+    VkDeviceSize block_bytes = 0;
+    for (auto &block : m_blocks)
+      block_bytes += block.size;
+
+    m_stats.aliased_bytes = m_stats.transient_bytes - block_bytes;
+  }
+
+  void rebuild_transients() {
+    release_transients();
+
+    m_transients.resize(m_order.size());
+
+    for (size_t i = 0; i < m_order.size(); i++) {
+      const Resource &resource = m_resources[m_order[i]];
+      TransientImage &transient = m_transients[i];
+
+      transient.desc = resource.desc;
+      transient.first_pass = resource.first_pass;
+      transient.last_pass = resource.last_pass;
+
+      VkImageCreateInfo image_info = VulkanBuffer::VulkanImageRegion::declare(
+          resource.desc.usage, resource.desc.extent.width,
+          resource.desc.extent.height, resource.desc.format,
+          VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_LAYOUT_UNDEFINED);
+
+      ZEPH_ENSURE(vkCreateImage(m_logical_device.handle, &image_info, nullptr,
+                                &transient.image) != VK_SUCCESS,
+                  "Couldn't create transient image ", resource.name);
+
+      vkGetImageMemoryRequirements(m_logical_device.handle, transient.image,
+                                   &transient.requirements);
+
+      transient.block = place_in_block(m_blocks, transient.first_pass,
+                                       transient.last_pass,
+                                       transient.requirements);
+    }
+
+    for (auto &block : m_blocks) {
+      VkMemoryAllocateInfo allocate_info{};
+      allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocate_info.allocationSize = block.size;
+      allocate_info.memoryTypeIndex = VulkanPhysicalDevice::find_memory_type(
+          m_physical_device.handle, block.type_bits,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+      ZEPH_ENSURE(vkAllocateMemory(m_logical_device.handle, &allocate_info,
+                                   nullptr, &block.memory) != VK_SUCCESS,
+                  "Couldn't allocate transient memory");
+    }
+
+    for (size_t i = 0; i < m_transients.size(); i++) {
+      TransientImage &transient = m_transients[i];
+
+      vkBindImageMemory(m_logical_device.handle, transient.image,
+                        m_blocks[transient.block].memory, 0);
+
+      transient.view = VulkanBuffer::VulkanImageView::make(
+          m_logical_device.handle, transient.image, transient.desc.format,
+          transient.desc.aspect);
+    }
+
+    LOG_INFO("Frame graph placed", m_transients.size(), "transient images in",
+             m_blocks.size(), "memory blocks");
+  }
+
+  void release_transients() {
+    for (auto &transient : m_transients) {
+      transient.view.cleanup();
+      vkDestroyImage(m_logical_device.handle, transient.image, nullptr);
+    }
+
+    for (auto &block : m_blocks)
+      vkFreeMemory(m_logical_device.handle, block.memory, nullptr);
+
+    m_transients.clear();
+    m_blocks.clear();
+  }
+
+  // Replays the live passes in order and records, per pass, the barriers its
+  // accesses need against the previous ones: read after write, write after
+  // write, write after read (execution only) and layout changes. Reads that
+  // an earlier barrier already made visible don't get another one.
+  void build_barriers() {
+    m_states.assign(m_resources.size(), State{});
+
+    for (size_t r = 0; r < m_resources.size(); r++) {
+      m_states[r].layout = m_resources[r].initial_layout;
+      m_states[r].write_stage = m_resources[r].previous.stage;
+      m_states[r].write_access = m_resources[r].previous.access;
+    }
+
+    for (size_t i = 0; i < m_pass_count; i++) {
+      Pass &pass = m_passes[i];
+
+      pass.src_stage = 0;
+      pass.dst_stage = 0;
+      pass.buffer_barriers.clear();
+      pass.image_barriers.clear();
+
+      if (!pass.live)
+        continue;
+
+      for (auto &use : pass.uses) {
+        Resource &resource = m_resources[use.resource];
+        State &state = m_states[use.resource];
+
+        // An aliased transient inherits the hazards of the previous image
+        // in its memory, but not its contents.
+        if (resource.alias_of >= 0 &&
+            resource.first_pass == static_cast<int32_t>(i)) {
+          state = m_states[resource.alias_of];
+          state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        add_barrier(pass, resource, state, use);
+      }
+
+      if (!pass.buffer_barriers.empty() || !pass.image_barriers.empty()) {
+        if (pass.src_stage == 0)
+          pass.src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+        m_stats.barrier_batch_count++;
+        m_stats.barrier_count +=
+            pass.buffer_barriers.size() + pass.image_barriers.size();
+      }
+    }
+  }
+
+  void add_barrier(Pass &pass, const Resource &resource, State &state,
+                   const Use &use) {
+    const FrameGraphAccess &access = use.access;
+
+    bool layout_change = resource.is_image &&
+                         !pass.render_pass_transitions &&
+                         access.layout != state.layout;
+
+    VkPipelineStageFlags src_stage = 0;
+    VkAccessFlags src_access = 0;
+
+    bool already_visible = (state.read_stages & access.stage) == access.stage &&
+                           (state.read_access & access.access) == access.access;
+
+    if (state.write_stage && (use.writes || !already_visible)) {
+      src_stage |= state.write_stage;
+      src_access |= state.write_access;
+    }
+
+    if (use.writes)
+      src_stage |= state.read_stages;
+
+    if (src_stage != 0 || layout_change) {
+      if (resource.is_image) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = access.access;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = layout_change ? access.layout : state.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image(use.resource);
+        barrier.subresourceRange.aspectMask = resource.desc.aspect;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+        pass.image_barriers.push_back(barrier);
+      } else if (resource.size > 0) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = access.access;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = resource.buffer;
+        barrier.offset = resource.offset;
+        barrier.size = resource.size;
+
+        pass.buffer_barriers.push_back(barrier);
+      }
+
+      pass.src_stage |= src_stage;
+      pass.dst_stage |= access.stage;
+    }
+
+    if (use.writes) {
+      state.write_stage = access.stage;
+      state.write_access = access.access;
+      state.read_stages = 0;
+      state.read_access = 0;
+    } else {
+      state.read_stages |= access.stage;
+      state.read_access |= access.access;
+    }
+
+    if (resource.is_image)
+      state.layout = access.layout;
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanPhysicalDevice m_physical_device;
+
+  std::vector<Resource> m_resources;
+  std::vector<Pass> m_passes;
+  size_t m_pass_count = 0;
+
+  std::vector<bool> m_needed;
+  std::vector<uint32_t> m_order;
+  std::vector<State> m_states;
+
+  std::vector<TransientImage> m_transients;
+  std::vector<FrameGraphMemoryBlock> m_blocks;
+
+  FrameGraphStats m_stats;
+};
+
+} // namespace zephyr
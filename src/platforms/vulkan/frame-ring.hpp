@@ -0,0 +1,208 @@
+#pragma once
+
+#include "assert.hpp"
+#include "log.hpp"
+#include "platforms/vulkan/buffer.hpp"
+#include "platforms/vulkan/device.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+struct FrameRingAllocation {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *data = nullptr;
+};
+
+struct FrameRingStats {
+  size_t allocation_count = 0;
+  VkDeviceSize bytes_allocated = 0;
+  VkDeviceSize bytes_flushed = 0;
+  size_t flush_count = 0;
+};
+
+// One persistently mapped buffer per frame in flight. A frame bumps through
+// its own buffer front to back, so writes land in ascending address order and
+// the dirty span is always [0, head). The buffer of a frame is only reset
+// after that frame's fence has been waited on.
+class VulkanFrameRing {
+public:
+  void init(VulkanLogicalDevice logical_device,
+            VulkanPhysicalDevice physical_device, uint32_t frame_count,
+            VkBufferUsageFlags usage) {
+    m_logical_device = logical_device;
+    m_physical_device = physical_device;
+    m_usage = usage;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device.handle, &props);
+
+    m_min_alignment =
+        std::max(props.limits.minUniformBufferOffsetAlignment,
+                 props.limits.minStorageBufferOffsetAlignment);
+    m_atom_size = std::max<VkDeviceSize>(props.limits.nonCoherentAtomSize, 1);
+
+    m_frames.resize(frame_count);
+  }
+
+  // Sizes every frame's buffer to hold at least `frame_capacity` bytes.
+  void reserve(VkDeviceSize frame_capacity) {
+    for (uint32_t i = 0; i < m_frames.size(); i++)
+      reserve(i, frame_capacity);
+  }
+
+  // Recreates a single frame's buffer. Only valid while that frame is idle.
+  void reserve(uint32_t frame_index, VkDeviceSize frame_capacity) {
+    Frame &frame = m_frames[frame_index];
+
+    if (frame.region.buffer != VK_NULL_HANDLE &&
+        frame.region.size >= frame_capacity)
+      return;
+
+    release(frame);
+
+    frame.region = VulkanBuffer::TransientStagingRegion::make(
+        m_logical_device, frame_capacity, m_usage);
+
+    VkMemoryRequirements mem_requirements;
+    vkGetBufferMemoryRequirements(m_logical_device.handle, frame.region.buffer,
+                                  &mem_requirements);
+
+    // Host visible is all an upload ring needs. Whether the chosen type is
+    // also coherent decides if flush() has work to do.
+    uint32_t type = VulkanPhysicalDevice::find_memory_type(
+        m_physical_device.handle, mem_requirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(m_physical_device.handle,
+                                        &memory_properties);
+
+    frame.coherent = memory_properties.memoryTypes[type].propertyFlags &
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    frame.memory_size = mem_requirements.size;
+
+    frame.region.allocate(m_physical_device,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                          mem_requirements);
+    frame.region.map();
+    frame.head = 0;
+  }
+
+  void begin_frame(uint32_t frame_index) {
+    m_current = frame_index;
+
+    Frame &frame = m_frames[frame_index];
+    frame.head = 0;
+    frame.stats = {};
+  }
+
+  FrameRingAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0) {
+    Frame &frame = m_frames[m_current];
+
+    VkDeviceSize offset =
+        align(frame.head, std::max(alignment, m_min_alignment));
+
+    ZEPH_ENSURE(offset + size > frame.region.size, "Frame ring overflow: ",
+                offset + size, " of ", frame.region.size, " bytes");
+
+    frame.head = offset + size;
+    frame.stats.allocation_count++;
+    frame.stats.bytes_allocated += size;
+
+    return {frame.region.buffer, offset, size,
+            static_cast<char *>(frame.region.mapped) + offset};
+  }
+
+  template <typename T> FrameRingAllocation push(const T &value) {
+    FrameRingAllocation allocation = allocate(sizeof(T), alignof(T));
+    memcpy(allocation.data, &value, sizeof(T));
+    return allocation;
+  }
+
+  // Makes the frame's writes visible to the device. Coherent memory needs no
+  // flush; otherwise only the written span is flushed, widened to whole atoms.
+  void flush() {
+    Frame &frame = m_frames[m_current];
+
+    if (!frame.coherent && frame.head > 0) {
+      VkDeviceSize size = align(frame.head, m_atom_size);
+
+      frame.region.flush(0, size >= frame.memory_size ? VK_WHOLE_SIZE : size);
+      frame.stats.bytes_flushed += size;
+      frame.stats.flush_count++;
+    }
+
+    REPORT_METRIC("renderer", "frame_ring_allocations",
+                  frame.stats.allocation_count);
+    REPORT_METRIC("renderer", "frame_ring_bytes_allocated",
+                  frame.stats.bytes_allocated);
+    REPORT_METRIC("renderer", "frame_ring_bytes_flushed",
+                  frame.stats.bytes_flushed);
+  }
+
+  // Makes device writes to a frame's buffer visible to the host. Only valid
+  // once that frame's fence has been waited on.
+  void invalidate(uint32_t frame_index) {
+    Frame &frame = m_frames[frame_index];
+
+    if (!frame.coherent)
+      frame.region.invalidate(0);
+  }
+
+  VkDeviceSize aligned_size(VkDeviceSize size) const {
+    return align(size, m_min_alignment);
+  }
+
+  VkBuffer buffer(uint32_t frame_index) const {
+    return m_frames[frame_index].region.buffer;
+  }
+
+  VkDeviceSize capacity(uint32_t frame_index) const {
+    return m_frames[frame_index].region.size;
+  }
+
+  const FrameRingStats &stats() const { return m_frames[m_current].stats; }
+
+  void cleanup() {
+    for (auto &frame : m_frames)
+      release(frame);
+  }
+
+private:
+  struct Frame {
+    VulkanBuffer::TransientStagingRegion region;
+    VkDeviceSize memory_size = 0;
+    VkDeviceSize head = 0;
+    bool coherent = true;
+    FrameRingStats stats;
+  };
+
+  static VkDeviceSize align(VkDeviceSize offset, VkDeviceSize alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+  }
+
+  static void release(Frame &frame) {
+    if (frame.region.buffer == VK_NULL_HANDLE)
+      return;
+
+    frame.region.unmap();
+    frame.region.cleanup();
+    frame.region = {};
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanPhysicalDevice m_physical_device;
+  VkBufferUsageFlags m_usage = 0;
+  VkDeviceSize m_min_alignment = 1;
+  VkDeviceSize m_atom_size = 1;
+
+  std::vector<Frame> m_frames;
+  uint32_t m_current = 0;
+};
+
+} // namespace zephyr
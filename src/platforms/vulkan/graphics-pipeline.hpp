@@ -4,6 +4,7 @@
 #include "mesh.hpp"
 #include "platforms/vulkan/descriptor-set.hpp"
 #include "platforms/vulkan/device.hpp"
+#include "platforms/vulkan/pipeline-cache.hpp"
 #include "platforms/vulkan/render-pass.hpp"
 #include "platforms/vulkan/shader.hpp"
 #include "platforms/vulkan/swap-chain.hpp"
@@ -15,11 +16,18 @@ class VulkanGraphicsPipeline {
 public:
   struct Config {
     std::string vert_path;
+    // Empty for depth-only pipelines, which have no fragment stage and no
+    // color attachment.
     std::string frag_path;
     VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
     bool vertex_input = true;
     bool alpha_blend = false;
+    bool depth_test = false;
+    bool depth_write = false;
     bool owns_render_pass = true;
+    uint32_t push_constant_size = 0;
+    // Layout of set 1, e.g. the texture table. None when null.
+    VkDescriptorSetLayout secondary_set_layout = VK_NULL_HANDLE;
   };
 
   VulkanGraphicsPipeline() = default;
@@ -32,14 +40,18 @@ public:
   static VulkanGraphicsPipeline
   create(VulkanLogicalDevice logical_device, VulkanSwapChain swap_chain,
          VulkanDescriptorSetLayout descriptor_set_layout,
-         VulkanRenderPass render_pass, Config config) {
+         VulkanRenderPass render_pass, Config config,
+         VulkanPipelineCache *cache = nullptr) {
     return build(logical_device, swap_chain, descriptor_set_layout, render_pass,
-                 config);
+                 config, cache);
   }
 
   void cleanup() {
-    vkDestroyPipeline(m_ld_handle, m_handle, nullptr);
-    vkDestroyPipelineLayout(m_ld_handle, m_pipeline_layout, nullptr);
+    // Pipelines from a cache are shared and destroyed with it.
+    if (!m_cached) {
+      vkDestroyPipeline(m_ld_handle, m_handle, nullptr);
+      vkDestroyPipelineLayout(m_ld_handle, m_pipeline_layout, nullptr);
+    }
 
     if (m_owns_render_pass)
       vkDestroyRenderPass(m_ld_handle, m_render_pass.handle, nullptr);
@@ -54,14 +66,55 @@ private:
   static VulkanGraphicsPipeline
   build(VulkanLogicalDevice logical_device, VulkanSwapChain swap_chain,
         VulkanDescriptorSetLayout descriptor_set_layout,
-        VulkanRenderPass render_pass, Config config) {
-
-    auto vertex = read_file(config.vert_path);
-    auto frag = read_file(config.frag_path);
+        VulkanRenderPass render_pass, Config config,
+        VulkanPipelineCache *cache) {
+    std::vector<VkDescriptorSetLayout> set_layouts = {
+        descriptor_set_layout.handle()};
+    if (config.secondary_set_layout != VK_NULL_HANDLE)
+      set_layouts.push_back(config.secondary_set_layout);
+
+    std::vector<char> vertex =
+        cache ? cache->shader(config.vert_path) : read_file(config.vert_path);
+    bool depth_only = config.frag_path.empty();
+
+    std::vector<char> frag;
+    if (!depth_only)
+      frag = cache ? cache->shader(config.frag_path)
+                   : read_file(config.frag_path);
+
+    // Viewport and scissor are dynamic, so the extent stays out of the key.
+    uint64_t key = PipelineHasher{}
+                       .add(vertex)
+                       .add(frag)
+                       .add(config.cull_mode)
+                       .add(config.vertex_input)
+                       .add(config.alpha_blend)
+                       .add(config.depth_test)
+                       .add(config.depth_write)
+                       .add(config.push_constant_size)
+                       .add(set_layouts[0])
+                       .add(config.secondary_set_layout)
+                       .add(render_pass.handle)
+                       .value;
+
+    if (cache) {
+      if (VkPipeline cached = cache->find(key); cached != VK_NULL_HANDLE) {
+        VulkanGraphicsPipeline pipeline(
+            logical_device.handle, cached,
+            cache->layout(set_layouts, VK_SHADER_STAGE_VERTEX_BIT,
+                          config.push_constant_size),
+            render_pass);
+        pipeline.m_owns_render_pass = config.owns_render_pass;
+        pipeline.m_cached = true;
+        return pipeline;
+      }
+    }
 
     VkShaderModule vertex_module =
         Shader::create_module(logical_device, vertex);
-    VkShaderModule frag_module = Shader::create_module(logical_device, frag);
+    VkShaderModule frag_module = VK_NULL_HANDLE;
+    if (!depth_only)
+      frag_module = Shader::create_module(logical_device, frag);
 
     VkPipelineShaderStageCreateInfo vertex_stage{};
     vertex_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -160,27 +213,50 @@ private:
         VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     color_blend_info.logicOpEnable = VK_FALSE;
     color_blend_info.logicOp = VK_LOGIC_OP_COPY;
-    color_blend_info.attachmentCount = 1;
+    color_blend_info.attachmentCount = depth_only ? 0 : 1;
     color_blend_info.pAttachments = &color_blend_attachment;
 
-    VkDescriptorSetLayout set_layout = descriptor_set_layout.handle();
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_info{};
+    depth_stencil_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil_info.depthTestEnable = config.depth_test ? VK_TRUE : VK_FALSE;
+    depth_stencil_info.depthWriteEnable =
+        config.depth_write ? VK_TRUE : VK_FALSE;
+    depth_stencil_info.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depth_stencil_info.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil_info.stencilTestEnable = VK_FALSE;
+
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = config.push_constant_size;
 
     VkPipelineLayoutCreateInfo pipeline_layout_info{};
     pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = 1;
-    pipeline_layout_info.pSetLayouts = &set_layout;
+    pipeline_layout_info.setLayoutCount =
+        static_cast<uint32_t>(set_layouts.size());
+    pipeline_layout_info.pSetLayouts = set_layouts.data();
+    pipeline_layout_info.pushConstantRangeCount =
+        config.push_constant_size > 0 ? 1 : 0;
+    pipeline_layout_info.pPushConstantRanges =
+        config.push_constant_size > 0 ? &push_constant_range : nullptr;
 
     VkPipeline handle;
     VkPipelineLayout pipeline_layout;
 
-    ZEPH_ENSURE(vkCreatePipelineLayout(logical_device.handle,
-                                       &pipeline_layout_info, nullptr,
-                                       &pipeline_layout) != VK_SUCCESS,
-                "Couldn't create pipeline layout");
+    if (cache) {
+      pipeline_layout = cache->layout(set_layouts, VK_SHADER_STAGE_VERTEX_BIT,
+                                      config.push_constant_size);
+    } else {
+      ZEPH_ENSURE(vkCreatePipelineLayout(logical_device.handle,
+                                         &pipeline_layout_info, nullptr,
+                                         &pipeline_layout) != VK_SUCCESS,
+                  "Couldn't create pipeline layout");
+    }
 
     VkGraphicsPipelineCreateInfo pipeline_info{};
     pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = 2;
+    pipeline_info.stageCount = depth_only ? 1 : 2;
     pipeline_info.pStages = shader_stages;
     pipeline_info.pDynamicState = &dynamic_state;
     pipeline_info.pVertexInputState = &vertex_input_info;
@@ -189,24 +265,35 @@ private:
     pipeline_info.pRasterizationState = &rasterizer_info;
     pipeline_info.pMultisampleState = &multisampling_info;
     pipeline_info.pColorBlendState = &color_blend_info;
-    pipeline_info.pDepthStencilState = nullptr;
+    pipeline_info.pDepthStencilState = &depth_stencil_info;
     pipeline_info.layout = pipeline_layout;
     pipeline_info.renderPass = render_pass.handle;
     pipeline_info.subpass = 0;
     pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
     pipeline_info.basePipelineIndex = -1;
 
-    ZEPH_ENSURE(vkCreateGraphicsPipelines(logical_device.handle, VK_NULL_HANDLE,
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    if (cache)
+      pipeline_cache = cache->handle();
+
+    ZEPH_ENSURE(vkCreateGraphicsPipelines(logical_device.handle, pipeline_cache,
                                           1, &pipeline_info, nullptr,
                                           &handle) != VK_SUCCESS,
                 "Couldn't create graphics pipeline");
 
     vkDestroyShaderModule(logical_device.handle, vertex_module, nullptr);
-    vkDestroyShaderModule(logical_device.handle, frag_module, nullptr);
+    if (!depth_only)
+      vkDestroyShaderModule(logical_device.handle, frag_module, nullptr);
 
     VulkanGraphicsPipeline pipeline(logical_device.handle, handle,
                                     pipeline_layout, render_pass);
     pipeline.m_owns_render_pass = config.owns_render_pass;
+
+    if (cache) {
+      pipeline.m_handle = cache->insert(key, handle);
+      pipeline.m_cached = true;
+    }
+
     return pipeline;
   }
 
@@ -215,6 +302,7 @@ private:
   VkPipelineLayout m_pipeline_layout;
   VulkanRenderPass m_render_pass;
   bool m_owns_render_pass = true;
+  bool m_cached = false;
 };
 
 } // namespace zephyr
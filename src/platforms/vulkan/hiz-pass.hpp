@@ -0,0 +1,318 @@
+#pragma once
+
+#include "log.hpp"
+#include "platforms/vulkan/compute-pipeline.hpp"
+#include "platforms/vulkan/descriptor-allocator.hpp"
+#include "platforms/vulkan/descriptor-set.hpp"
+#include "platforms/vulkan/device.hpp"
+#include "platforms/vulkan/image.hpp"
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// Builds a hierarchical depth pyramid from the depth buffer. Level 0 copies
+// the depth buffer and every further level keeps the farthest depth of the
+// 2x2 texels below it, so one fetch bounds the depth of a whole screen
+// region. The pyramid stays in VK_IMAGE_LAYOUT_GENERAL: levels are written
+// as storage images and the whole chain is sampled by the culling shader.
+class VulkanHiZPass {
+public:
+  static constexpr uint32_t WORKGROUP_SIZE = 8;
+  static constexpr VkFormat FORMAT = VK_FORMAT_R32_SFLOAT;
+
+  void init(VulkanLogicalDevice logical_device,
+            VulkanPhysicalDevice physical_device,
+            VulkanDescriptorLayoutCache &layouts,
+            VulkanPipelineCache *cache = nullptr) {
+    m_logical_device = logical_device;
+    m_physical_device = physical_device;
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    m_set_layout = layouts.get(bindings);
+
+    // Texel fetches ignore filtering; clamping keeps the culling shader's
+    // edge fetches in range.
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_NEAREST;
+    sampler_info.minFilter = VK_FILTER_NEAREST;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+    ZEPH_ENSURE(vkCreateSampler(logical_device.handle, &sampler_info, nullptr,
+                                &m_sampler) != VK_SUCCESS,
+                "Couldn't create Hi-Z sampler");
+
+    m_pipeline = VulkanComputePipeline::create(
+        logical_device, m_set_layout,
+        {.comp_path = "assets/shaders/hiz.comp.spv",
+         .push_constant_size = sizeof(PushConstants)},
+        cache);
+  }
+
+  // (Re)creates the pyramid for a depth buffer. Only valid while the device
+  // is idle, since the old pyramid may still be read.
+  void resize(VkImageView depth_view, VkExtent2D extent) {
+    release_pyramid();
+
+    m_extent = extent;
+    m_levels = 1;
+    while ((std::max(extent.width, extent.height) >> m_levels) > 0)
+      m_levels++;
+
+    VkImageCreateInfo image_info = VulkanBuffer::VulkanImageRegion::declare(
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        extent.width, extent.height, FORMAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_LAYOUT_UNDEFINED);
+    image_info.mipLevels = m_levels;
+
+    ZEPH_ENSURE(vkCreateImage(m_logical_device.handle, &image_info, nullptr,
+                              &m_image) != VK_SUCCESS,
+                "Couldn't create Hi-Z image");
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(m_logical_device.handle, m_image,
+                                 &requirements);
+
+    VkMemoryAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate_info.allocationSize = requirements.size;
+    allocate_info.memoryTypeIndex = VulkanPhysicalDevice::find_memory_type(
+        m_physical_device.handle, requirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    ZEPH_ENSURE(vkAllocateMemory(m_logical_device.handle, &allocate_info,
+                                 nullptr, &m_memory) != VK_SUCCESS,
+                "Couldn't allocate Hi-Z memory");
+
+    vkBindImageMemory(m_logical_device.handle, m_image, m_memory, 0);
+
+    m_chain_view = create_view(0, m_levels);
+    m_level_views.resize(m_levels);
+    for (uint32_t level = 0; level < m_levels; level++)
+      m_level_views[level] = create_view(level, 1);
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_levels},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_levels}};
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = 2;
+    pool_info.pPoolSizes = pool_sizes;
+    pool_info.maxSets = m_levels;
+
+    ZEPH_ENSURE(vkCreateDescriptorPool(m_logical_device.handle, &pool_info,
+                                       nullptr, &m_pool) != VK_SUCCESS,
+                "Couldn't create Hi-Z descriptor pool");
+
+    std::vector<VkDescriptorSetLayout> layouts(m_levels, m_set_layout.handle());
+
+    VkDescriptorSetAllocateInfo set_info{};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = m_pool;
+    set_info.descriptorSetCount = m_levels;
+    set_info.pSetLayouts = layouts.data();
+
+    m_sets.resize(m_levels);
+
+    ZEPH_ENSURE(vkAllocateDescriptorSets(m_logical_device.handle, &set_info,
+                                         m_sets.data()) != VK_SUCCESS,
+                "Couldn't allocate Hi-Z descriptor sets");
+
+    for (uint32_t level = 0; level < m_levels; level++) {
+      VkDescriptorImageInfo source{};
+      source.sampler = m_sampler;
+      source.imageView = level == 0 ? depth_view : m_level_views[level - 1];
+      source.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_GENERAL;
+
+      VkDescriptorImageInfo destination{};
+      destination.imageView = m_level_views[level];
+      destination.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      std::array<VkWriteDescriptorSet, 2> writes{};
+
+      writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[0].dstSet = m_sets[level];
+      writes[0].dstBinding = 0;
+      writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[0].descriptorCount = 1;
+      writes[0].pImageInfo = &source;
+
+      writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[1].dstSet = m_sets[level];
+      writes[1].dstBinding = 1;
+      writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      writes[1].descriptorCount = 1;
+      writes[1].pImageInfo = &destination;
+
+      vkUpdateDescriptorSets(m_logical_device.handle, writes.size(),
+                             writes.data(), 0, nullptr);
+    }
+
+    LOG_INFO("Hi-Z pyramid", extent.width, "x", extent.height, "with",
+             m_levels, "levels");
+  }
+
+  // Records one dispatch per level. The depth buffer must be readable and
+  // the pyramid in VK_IMAGE_LAYOUT_GENERAL; the frame graph handles both.
+  // Between levels only the level just written needs a barrier.
+  void record(VkCommandBuffer command_buffer) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      m_pipeline.handle());
+
+    for (uint32_t level = 0; level < m_levels; level++) {
+      VkExtent2D source = level == 0 ? m_extent : level_extent(level - 1);
+      VkExtent2D destination = level_extent(level);
+
+      PushConstants push{};
+      push.source_size[0] = static_cast<int32_t>(source.width);
+      push.source_size[1] = static_cast<int32_t>(source.height);
+      push.destination_size[0] = static_cast<int32_t>(destination.width);
+      push.destination_size[1] = static_cast<int32_t>(destination.height);
+
+      vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              m_pipeline.layout(), 0, 1, &m_sets[level], 0,
+                              nullptr);
+
+      vkCmdPushConstants(command_buffer, m_pipeline.layout(),
+                         VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+      vkCmdDispatch(command_buffer,
+                    (destination.width + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                    (destination.height + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                    1);
+
+      if (level + 1 == m_levels)
+        break;
+
+      VkImageMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = m_image;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.baseMipLevel = level;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.layerCount = 1;
+
+      vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                           0, nullptr, 1, &barrier);
+    }
+
+    REPORT_METRIC("renderer", "hiz_levels", m_levels);
+  }
+
+  VkExtent2D level_extent(uint32_t level) const {
+    return {std::max(m_extent.width >> level, 1u),
+            std::max(m_extent.height >> level, 1u)};
+  }
+
+  // The first level whose sides both fit in `max_size`.
+  uint32_t level_within(uint32_t max_size) const {
+    uint32_t level = 0;
+    while (level + 1 < m_levels &&
+           std::max(level_extent(level).width, level_extent(level).height) >
+               max_size)
+      level++;
+
+    return level;
+  }
+
+  VkImage image() const { return m_image; }
+  VkImageView view() const { return m_chain_view; }
+  VkSampler sampler() const { return m_sampler; }
+  VkExtent2D extent() const { return m_extent; }
+  uint32_t levels() const { return m_levels; }
+
+  void cleanup() {
+    release_pyramid();
+    m_pipeline.cleanup();
+    vkDestroySampler(m_logical_device.handle, m_sampler, nullptr);
+  }
+
+private:
+  struct PushConstants {
+    int32_t source_size[2];
+    int32_t destination_size[2];
+  };
+
+  VkImageView create_view(uint32_t base_level, uint32_t level_count) {
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = m_image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = FORMAT;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.baseMipLevel = base_level;
+    view_info.subresourceRange.levelCount = level_count;
+    view_info.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+
+    ZEPH_ENSURE(vkCreateImageView(m_logical_device.handle, &view_info, nullptr,
+                                  &view) != VK_SUCCESS,
+                "Couldn't create Hi-Z image view");
+
+    return view;
+  }
+
+  void release_pyramid() {
+    if (m_image == VK_NULL_HANDLE)
+      return;
+
+    vkDestroyDescriptorPool(m_logical_device.handle, m_pool, nullptr);
+
+    for (auto view : m_level_views)
+      vkDestroyImageView(m_logical_device.handle, view, nullptr);
+
+    vkDestroyImageView(m_logical_device.handle, m_chain_view, nullptr);
+    vkDestroyImage(m_logical_device.handle, m_image, nullptr);
+    vkFreeMemory(m_logical_device.handle, m_memory, nullptr);
+
+    m_level_views.clear();
+    m_sets.clear();
+    m_image = VK_NULL_HANDLE;
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanPhysicalDevice m_physical_device;
+  VulkanDescriptorSetLayout m_set_layout;
+  VkSampler m_sampler = VK_NULL_HANDLE;
+  VulkanComputePipeline m_pipeline;
+
+  VkExtent2D m_extent{};
+  uint32_t m_levels = 0;
+  VkImage m_image = VK_NULL_HANDLE;
+  VkDeviceMemory m_memory = VK_NULL_HANDLE;
+  VkImageView m_chain_view = VK_NULL_HANDLE;
+  std::vector<VkImageView> m_level_views;
+  VkDescriptorPool m_pool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> m_sets;
+};
+
+} // namespace zephyr
@@ -15,8 +15,9 @@ struct VulkanImageView {
   VkImageView handle = VK_NULL_HANDLE;
   VkDevice ld_handle = VK_NULL_HANDLE;
 
-  static VulkanImageView make(VkDevice ld_handle, VkImage image,
-                              VkFormat format) {
+  static VulkanImageView
+  make(VkDevice ld_handle, VkImage image, VkFormat format,
+       VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT) {
     VulkanImageView view;
     view.ld_handle = ld_handle;
 
@@ -27,7 +28,7 @@ struct VulkanImageView {
     view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
     view_info.format = format;
 
-    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.aspectMask = aspect;
     view_info.subresourceRange.baseMipLevel = 0;
     view_info.subresourceRange.levelCount = 1;
     view_info.subresourceRange.baseArrayLayer = 0;
@@ -152,7 +153,8 @@ public:
   }
 
   void allocate(VulkanPhysicalDevice physical_device,
-                VkMemoryPropertyFlags device_properties) {
+                VkMemoryPropertyFlags device_properties,
+                VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT) {
     VkMemoryRequirements mem_requirements;
 
     vkGetImageMemoryRequirements(ld_handle, image, &mem_requirements);
@@ -171,7 +173,7 @@ public:
 
     vkBindImageMemory(ld_handle, image, memory, 0);
 
-    image_view = VulkanImageView::make(ld_handle, image, format);
+    image_view = VulkanImageView::make(ld_handle, image, format, aspect);
     sampler = VulkanSampler::make(ld_handle, ph_handle);
   }
 
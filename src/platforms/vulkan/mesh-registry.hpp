@@ -0,0 +1,154 @@
+#pragma once
+
+#include "log.hpp"
+#include "mesh.hpp"
+#include "platforms/vulkan/buffer.hpp"
+#include "platforms/vulkan/command-pool.hpp"
+#include "platforms/vulkan/device.hpp"
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// Packs every registered mesh into one shared vertex buffer and one shared
+// index buffer. Both are bound once per frame and each draw selects its mesh
+// through the handle's index range and vertex offset. Meshes are never
+// removed, so the ranges handed out never move or get reused; owns() is the
+// check for handles that come from somewhere else.
+class VulkanMeshRegistry {
+public:
+  void init(VulkanLogicalDevice logical_device,
+            VulkanPhysicalDevice physical_device,
+            VulkanCommandPool command_pool) {
+    m_logical_device = logical_device;
+    m_physical_device = physical_device;
+    m_command_pool = command_pool;
+  }
+
+  // Keeps a reference to the asset instead of copying its geometry. The
+  // data is only read again when the device buffers are rebuilt.
+  MeshHandle add(MeshAsset mesh) {
+    MeshHandle handle{};
+    handle.first_index = static_cast<uint32_t>(m_index_count);
+    handle.index_count = static_cast<uint32_t>(mesh->indices.size());
+    handle.vertex_offset = static_cast<int32_t>(m_vertex_count);
+    handle.bounds = mesh->bounding_sphere();
+
+    m_vertex_count += mesh->vertices.size();
+    m_index_count += mesh->indices.size();
+    m_assets.push_back(std::move(mesh));
+
+    m_dirty = true;
+    return handle;
+  }
+
+  const std::vector<MeshAsset> &assets() const { return m_assets; }
+
+  bool owns(const MeshHandle &handle) const {
+    return uint64_t{handle.first_index} + handle.index_count <= m_index_count &&
+           handle.vertex_offset >= 0 &&
+           static_cast<size_t>(handle.vertex_offset) <= m_vertex_count;
+  }
+
+  // Rebuilds the device buffers when meshes were added since the last call.
+  // The previous buffers are destroyed here, so this must not run while a
+  // frame that still reads them is in flight.
+  void upload() {
+    if (!m_dirty || m_index_count == 0)
+      return;
+
+    release();
+
+    m_vertex_region = upload_region(
+        m_vertex_count * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        [](const Mesh &mesh) { return std::span(mesh.vertices); });
+    m_index_region = upload_region(
+        m_index_count * sizeof(VertexIndice), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        [](const Mesh &mesh) { return std::span(mesh.indices); });
+
+    m_dirty = false;
+
+    LOG_INFO("Uploaded", m_vertex_count, "vertices and", m_index_count,
+             "indices to the mesh registry");
+  }
+
+  void bind(VkCommandBuffer command_buffer) const {
+    if (m_vertex_region.buffer == VK_NULL_HANDLE)
+      return;
+
+    VkBuffer vertex_buffers[] = {m_vertex_region.buffer};
+    VkDeviceSize offsets[] = {0};
+
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+
+    vkCmdBindIndexBuffer(command_buffer, m_index_region.buffer, 0,
+                         VK_INDEX_TYPE_UINT32);
+  }
+
+  void cleanup() { release(); }
+
+private:
+  // Streams each asset's span straight into the staging buffer, in
+  // registration order, so no concatenated CPU copy is built.
+  template <typename Fn>
+  VulkanBuffer::DeviceLocalRegion upload_region(VkDeviceSize size,
+                                                VkBufferUsageFlags usage,
+                                                Fn &&span_of) {
+    auto staging_buffer = VulkanBuffer::TransientStagingRegion::make(
+        m_logical_device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+    staging_buffer.allocate(m_physical_device,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    staging_buffer.map();
+
+    auto *dst = static_cast<std::byte *>(staging_buffer.mapped);
+    for (auto &asset : m_assets) {
+      auto span = span_of(*asset);
+      std::memcpy(dst, span.data(), span.size_bytes());
+      dst += span.size_bytes();
+    }
+
+    staging_buffer.unmap();
+
+    auto region = VulkanBuffer::DeviceLocalRegion::make(
+        m_logical_device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage);
+
+    region.allocate(m_physical_device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    region.copy_from(&staging_buffer, m_logical_device.graphics_queue,
+                     m_command_pool);
+
+    staging_buffer.cleanup();
+
+    return region;
+  }
+
+  void release() {
+    if (m_vertex_region.buffer != VK_NULL_HANDLE)
+      m_vertex_region.cleanup();
+    if (m_index_region.buffer != VK_NULL_HANDLE)
+      m_index_region.cleanup();
+
+    m_vertex_region = {};
+    m_index_region = {};
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanPhysicalDevice m_physical_device;
+  VulkanCommandPool m_command_pool;
+
+  std::vector<MeshAsset> m_assets;
+  size_t m_vertex_count = 0;
+  size_t m_index_count = 0;
+  bool m_dirty = false;
+
+  VulkanBuffer::DeviceLocalRegion m_vertex_region;
+  VulkanBuffer::DeviceLocalRegion m_index_region;
+};
+
+} // namespace zephyr
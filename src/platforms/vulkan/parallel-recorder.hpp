@@ -0,0 +1,192 @@
+#pragma once
+
+#include "assert.hpp"
+#include "platforms/vulkan/command-buffer.hpp"
+#include "platforms/vulkan/command-pool.hpp"
+#include "platforms/vulkan/device.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// Records a list of draws into secondary command buffers on several threads.
+// Every worker owns one transient pool per frame in flight, so pools are
+// never shared between threads and a frame's pools are only reset once its
+// fence has been waited on. The calling thread records slice 0 itself.
+class VulkanParallelRecorder {
+public:
+  // Records items [first, first + count) of the list into `command_buffer`.
+  using RecordFn = std::function<void(VkCommandBuffer command_buffer,
+                                      uint32_t slice, uint32_t first,
+                                      uint32_t count)>;
+
+  void init(VulkanLogicalDevice logical_device,
+            VulkanPhysicalDevice physical_device, uint32_t frame_count,
+            uint32_t worker_count) {
+    m_ld_handle = logical_device.handle;
+    m_worker_count = std::max(worker_count, 1u);
+
+    m_pools.resize(frame_count * m_worker_count);
+    m_command_buffers.resize(frame_count * m_worker_count);
+
+    for (size_t i = 0; i < m_pools.size(); i++) {
+      auto create_info = VulkanCommandPool::declare(
+          physical_device.queue_family_indices.graphics_family.value());
+      create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+      ZEPH_ENSURE(vkCreateCommandPool(m_ld_handle, &create_info, nullptr,
+                                      &m_pools[i]) != VK_SUCCESS,
+                  "Couldn't create recording command pool");
+
+      VkCommandBufferAllocateInfo alloc_info =
+          VulkanCommandBuffer::declare_allocate(
+              1, m_pools[i], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+      ZEPH_ENSURE(vkAllocateCommandBuffers(m_ld_handle, &alloc_info,
+                                           &m_command_buffers[i]) !=
+                      VK_SUCCESS,
+                  "Couldn't allocate secondary command buffer");
+    }
+
+    for (uint32_t worker = 1; worker < m_worker_count; worker++)
+      m_threads.emplace_back([this, worker] { worker_loop(worker); });
+  }
+
+  // Splits `item_count` items into at most one slice per worker, each at
+  // least `min_slice` long, and returns the recorded buffers in slice order.
+  // There is always at least one slice, even with no items.
+  const std::vector<VkCommandBuffer> &
+  record(uint32_t frame_index,
+         const VkCommandBufferInheritanceInfo &inheritance, uint32_t item_count,
+         uint32_t min_slice, const RecordFn &fn) {
+    min_slice = std::max(min_slice, 1u);
+    uint32_t wanted = (item_count + min_slice - 1) / min_slice;
+
+    {
+      std::lock_guard lock(m_mutex);
+      m_frame_index = frame_index;
+      m_inheritance = inheritance;
+      m_item_count = item_count;
+      m_slice_count = std::clamp(wanted, 1u, m_worker_count);
+      m_slice_size = (item_count + m_slice_count - 1) / m_slice_count;
+      m_fn = &fn;
+      m_error = nullptr;
+      m_pending = static_cast<uint32_t>(m_threads.size());
+      m_generation++;
+    }
+
+    m_wake.notify_all();
+
+    record_slice(0);
+
+    std::unique_lock lock(m_mutex);
+    m_done.wait(lock, [&] { return m_pending == 0; });
+
+    if (m_error)
+      std::rethrow_exception(m_error);
+
+    auto first = m_command_buffers.begin() + frame_index * m_worker_count;
+    m_recorded.assign(first, first + m_slice_count);
+
+    return m_recorded;
+  }
+
+  uint32_t worker_count() const { return m_worker_count; }
+
+  void cleanup() {
+    {
+      std::lock_guard lock(m_mutex);
+      m_stopping = true;
+    }
+
+    m_wake.notify_all();
+
+    for (auto &thread : m_threads)
+      thread.join();
+
+    m_threads.clear();
+
+    for (auto pool : m_pools)
+      vkDestroyCommandPool(m_ld_handle, pool, nullptr);
+
+    m_pools.clear();
+    m_command_buffers.clear();
+  }
+
+private:
+  void worker_loop(uint32_t worker) {
+    uint64_t seen = 0;
+
+    while (true) {
+      std::unique_lock lock(m_mutex);
+      m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+
+      if (m_stopping)
+        return;
+
+      seen = m_generation;
+      bool active = worker < m_slice_count;
+      lock.unlock();
+
+      if (active)
+        record_slice(worker);
+
+      lock.lock();
+      if (--m_pending == 0)
+        m_done.notify_one();
+    }
+  }
+
+  void record_slice(uint32_t slice) {
+    size_t index = m_frame_index * m_worker_count + slice;
+    VkCommandBuffer command_buffer = m_command_buffers[index];
+
+    uint32_t first = std::min(slice * m_slice_size, m_item_count);
+    uint32_t count = std::min(m_slice_size, m_item_count - first);
+
+    try {
+      vkResetCommandPool(m_ld_handle, m_pools[index], 0);
+
+      VulkanCommandBuffer::begin_secondary_command_buffer(command_buffer,
+                                                          m_inheritance);
+      (*m_fn)(command_buffer, slice, first, count);
+      VulkanCommandBuffer::end_command_buffer(command_buffer);
+    } catch (...) {
+      std::lock_guard lock(m_mutex);
+      if (m_error == nullptr)
+        m_error = std::current_exception();
+    }
+  }
+
+  VkDevice m_ld_handle = VK_NULL_HANDLE;
+  uint32_t m_worker_count = 1;
+
+  std::vector<VkCommandPool> m_pools;
+  std::vector<VkCommandBuffer> m_command_buffers;
+  std::vector<VkCommandBuffer> m_recorded;
+
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+  uint64_t m_generation = 0;
+  uint32_t m_pending = 0;
+  bool m_stopping = false;
+  std::exception_ptr m_error;
+
+  // Job of the current generation, read by workers after they wake.
+  uint32_t m_frame_index = 0;
+  VkCommandBufferInheritanceInfo m_inheritance{};
+  uint32_t m_item_count = 0;
+  uint32_t m_slice_count = 1;
+  uint32_t m_slice_size = 0;
+  const RecordFn *m_fn = nullptr;
+};
+
+} // namespace zephyr
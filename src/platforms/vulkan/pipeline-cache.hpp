@@ -0,0 +1,285 @@
+#pragma once
+
+#include "assert.hpp"
+#include "file.hpp"
+#include "log.hpp"
+#include "platforms/vulkan/device.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// FNV-1a over whatever goes into a pipeline, same scheme as the component
+// type hashes.
+struct PipelineHasher {
+  uint64_t value = 14695981039346656037ull;
+
+  PipelineHasher &add_bytes(const void *data, size_t size) {
+    auto *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+      value ^= bytes[i];
+      value *= 1099511628211ull;
+    }
+    return *this;
+  }
+
+  template <typename T> PipelineHasher &add(const T &field) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    return add_bytes(&field, sizeof(T));
+  }
+
+  PipelineHasher &add(const std::vector<char> &bytes) {
+    add(bytes.size());
+    return add_bytes(bytes.data(), bytes.size());
+  }
+};
+
+// Dedupes pipelines and pipeline layouts by content and keeps shader
+// bytecode read once per path. Pipelines are created against a
+// VkPipelineCache that is loaded from and saved to disk, so a warm start
+// skips shader compilation in the driver. Everything handed out stays owned
+// by the cache. Lookups are locked so pipelines can be built on workers.
+class VulkanPipelineCache {
+public:
+  void init(VulkanLogicalDevice logical_device,
+            VulkanPhysicalDevice physical_device, std::string path) {
+    m_ld_handle = logical_device.handle;
+    m_path = std::move(path);
+
+    vkGetPhysicalDeviceProperties(physical_device.handle, &m_properties);
+
+    std::vector<char> initial_data = load();
+
+    VkPipelineCacheCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = initial_data.size();
+    create_info.pInitialData = initial_data.data();
+
+    ZEPH_ENSURE(vkCreatePipelineCache(m_ld_handle, &create_info, nullptr,
+                                      &m_handle) != VK_SUCCESS,
+                "Couldn't create pipeline cache");
+  }
+
+  VkPipelineCache handle() const { return m_handle; }
+
+  const std::vector<char> &shader(const std::string &path) {
+    std::lock_guard lock(m_mutex);
+
+    auto it = m_shaders.find(path);
+    if (it == m_shaders.end())
+      it = m_shaders.emplace(path, read_file(path)).first;
+
+    return it->second;
+  }
+
+  // Set i of the layout is set_layouts[i].
+  VkPipelineLayout layout(std::span<const VkDescriptorSetLayout> set_layouts,
+                          VkShaderStageFlags push_constant_stages,
+                          uint32_t push_constant_size) {
+    PipelineHasher hasher;
+    for (auto set_layout : set_layouts)
+      hasher.add(set_layout);
+
+    uint64_t key =
+        hasher.add(push_constant_stages).add(push_constant_size).value;
+
+    std::lock_guard lock(m_mutex);
+
+    if (auto it = m_layouts.find(key); it != m_layouts.end())
+      return it->second;
+
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = push_constant_stages;
+    push_constant_range.offset = 0;
+    push_constant_range.size = push_constant_size;
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount =
+        static_cast<uint32_t>(set_layouts.size());
+    pipeline_layout_info.pSetLayouts = set_layouts.data();
+    pipeline_layout_info.pushConstantRangeCount =
+        push_constant_size > 0 ? 1 : 0;
+    pipeline_layout_info.pPushConstantRanges =
+        push_constant_size > 0 ? &push_constant_range : nullptr;
+
+    VkPipelineLayout pipeline_layout;
+
+    ZEPH_ENSURE(vkCreatePipelineLayout(m_ld_handle, &pipeline_layout_info,
+                                       nullptr,
+                                       &pipeline_layout) != VK_SUCCESS,
+                "Couldn't create pipeline layout");
+
+    m_layouts.emplace(key, pipeline_layout);
+    return pipeline_layout;
+  }
+
+  VkPipeline find(uint64_t key) {
+    std::lock_guard lock(m_mutex);
+
+    auto it = m_pipelines.find(key);
+
+    if (it == m_pipelines.end()) {
+      m_misses++;
+      REPORT_METRIC("renderer", "pipeline_cache_misses", m_misses);
+      return VK_NULL_HANDLE;
+    }
+
+    m_hits++;
+    REPORT_METRIC("renderer", "pipeline_cache_hits", m_hits);
+    return it->second;
+  }
+
+  // Returns the pipeline to use for `key`. When two threads built the same
+  // pipeline, the one inserted first wins and the other is destroyed.
+  VkPipeline insert(uint64_t key, VkPipeline pipeline) {
+    std::lock_guard lock(m_mutex);
+
+    auto [it, inserted] = m_pipelines.emplace(key, pipeline);
+    if (!inserted)
+      vkDestroyPipeline(m_ld_handle, pipeline, nullptr);
+
+    return it->second;
+  }
+
+  // Writes the driver's cache blob behind a header that ties it to this
+  // device and driver.
+  void save() {
+    size_t size = 0;
+    vkGetPipelineCacheData(m_ld_handle, m_handle, &size, nullptr);
+
+    std::vector<char> data(size);
+    vkGetPipelineCacheData(m_ld_handle, m_handle, &size, data.data());
+    data.resize(size);
+
+    FileHeader header = expected_header();
+    header.data_size = data.size();
+    header.data_hash =
+        PipelineHasher{}.add_bytes(data.data(), data.size()).value;
+
+    std::error_code error;
+    std::filesystem::create_directories(
+        std::filesystem::path(m_path).parent_path(), error);
+
+    std::ofstream file(m_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      LOG_WARN("Couldn't write pipeline cache to", m_path);
+      return;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(data.data(), data.size());
+
+    LOG_INFO("Saved", data.size(), "bytes of pipeline cache to", m_path);
+  }
+
+  void cleanup() {
+    for (auto &[key, pipeline] : m_pipelines)
+      vkDestroyPipeline(m_ld_handle, pipeline, nullptr);
+
+    for (auto &[key, pipeline_layout] : m_layouts)
+      vkDestroyPipelineLayout(m_ld_handle, pipeline_layout, nullptr);
+
+    vkDestroyPipelineCache(m_ld_handle, m_handle, nullptr);
+
+    m_pipelines.clear();
+    m_layouts.clear();
+    m_shaders.clear();
+  }
+
+private:
+  static constexpr uint32_t FILE_MAGIC = 0x43504c5a; // "ZLPC"
+  static constexpr uint32_t FILE_VERSION = 1;
+
+  struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t data_hash;
+  };
+
+  FileHeader expected_header() const {
+    FileHeader header{};
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.vendor_id = m_properties.vendorID;
+    header.device_id = m_properties.deviceID;
+    header.driver_version = m_properties.driverVersion;
+    memcpy(header.uuid, m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    return header;
+  }
+
+  // Returns the stored blob, or nothing when the file is missing, corrupt,
+  // or was written by another device or driver version. The driver also
+  // checks its own header, but a stale blob is dropped before it gets there.
+  std::vector<char> load() {
+    std::ifstream file(m_path, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+      return {};
+
+    size_t file_size = static_cast<size_t>(file.tellg());
+    if (file_size < sizeof(FileHeader)) {
+      LOG_WARN("Ignoring truncated pipeline cache", m_path);
+      return {};
+    }
+
+    FileHeader header;
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+    FileHeader expected = expected_header();
+
+    if (header.magic != expected.magic || header.version != expected.version ||
+        header.vendor_id != expected.vendor_id ||
+        header.device_id != expected.device_id ||
+        header.driver_version != expected.driver_version ||
+        memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) != 0) {
+      LOG_INFO("Pipeline cache", m_path,
+               "belongs to another device or driver");
+      return {};
+    }
+
+    if (header.data_size != file_size - sizeof(FileHeader)) {
+      LOG_WARN("Ignoring truncated pipeline cache", m_path);
+      return {};
+    }
+
+    std::vector<char> data(header.data_size);
+    file.read(data.data(), data.size());
+
+    if (PipelineHasher{}.add_bytes(data.data(), data.size()).value !=
+        header.data_hash) {
+      LOG_WARN("Ignoring corrupt pipeline cache", m_path);
+      return {};
+    }
+
+    LOG_INFO("Loaded", data.size(), "bytes of pipeline cache from", m_path);
+    return data;
+  }
+
+  VkDevice m_ld_handle = VK_NULL_HANDLE;
+  VkPipelineCache m_handle = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties m_properties{};
+  std::string m_path;
+
+  std::mutex m_mutex;
+  std::unordered_map<std::string, std::vector<char>> m_shaders;
+  std::unordered_map<uint64_t, VkPipelineLayout> m_layouts;
+  std::unordered_map<uint64_t, VkPipeline> m_pipelines;
+  size_t m_hits = 0;
+  size_t m_misses = 0;
+};
+
+} // namespace zephyr
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "log.hpp"
+#include "platforms/vulkan/descriptor-set.hpp"
+#include "platforms/vulkan/device.hpp"
+#include "platforms/vulkan/graphics-pipeline.hpp"
+#include "platforms/vulkan/pipeline-cache.hpp"
+#include "platforms/vulkan/render-pass.hpp"
+#include "platforms/vulkan/swap-chain.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zephyr {
+
+// A pipeline that may still be compiling. Copies share the same state, so
+// the renderer can hold one while a worker fills it in.
+class VulkanPipelineHandle {
+public:
+  bool valid() const { return m_state != nullptr; }
+
+  bool ready() const {
+    return m_state && m_state->ready.load(std::memory_order_acquire);
+  }
+
+  bool failed() const {
+    return m_state && m_state->failed.load(std::memory_order_acquire);
+  }
+
+  // Only valid once ready() returned true.
+  const VulkanGraphicsPipeline &get() const { return m_state->pipeline; }
+
+  void cleanup() {
+    if (ready())
+      m_state->pipeline.cleanup();
+
+    m_state.reset();
+  }
+
+private:
+  friend class VulkanPipelineCompiler;
+
+  struct State {
+    VulkanGraphicsPipeline pipeline;
+    std::atomic<bool> ready{false};
+    std::atomic<bool> failed{false};
+  };
+
+  std::shared_ptr<State> m_state;
+};
+
+// Builds graphics pipelines on background threads so new variants never
+// stall a frame. Draws whose pipeline isn't ready yet are skipped by the
+// caller. Pipelines go through the shared cache, so a variant seen in an
+// earlier run comes back from the driver cache almost immediately.
+class VulkanPipelineCompiler {
+public:
+  void init(VulkanLogicalDevice logical_device, VulkanPipelineCache *cache,
+            uint32_t worker_count) {
+    m_logical_device = logical_device;
+    m_cache = cache;
+
+    for (uint32_t i = 0; i < std::max(worker_count, 1u); i++)
+      m_threads.emplace_back([this] { worker_loop(); });
+  }
+
+  VulkanPipelineHandle compile(VulkanSwapChain swap_chain,
+                               VulkanDescriptorSetLayout descriptor_set_layout,
+                               VulkanRenderPass render_pass,
+                               VulkanGraphicsPipeline::Config config) {
+    VulkanPipelineHandle handle;
+    handle.m_state = std::make_shared<VulkanPipelineHandle::State>();
+
+    auto state = handle.m_state;
+
+    {
+      std::lock_guard lock(m_mutex);
+      m_jobs.push_back([this, state, swap_chain, descriptor_set_layout,
+                        render_pass, config] {
+        try {
+          state->pipeline = VulkanGraphicsPipeline::create(
+              m_logical_device, swap_chain, descriptor_set_layout,
+              render_pass, config, m_cache);
+          state->ready.store(true, std::memory_order_release);
+        } catch (const std::exception &error) {
+          LOG_ERROR("Couldn't compile pipeline", config.vert_path,
+                    config.frag_path, error.what());
+          state->failed.store(true, std::memory_order_release);
+        }
+      });
+    }
+
+    m_wake.notify_one();
+
+    return handle;
+  }
+
+  // Jobs that haven't started are dropped; their handles never turn ready.
+  void cleanup() {
+    {
+      std::lock_guard lock(m_mutex);
+      m_stopping = true;
+      m_jobs.clear();
+    }
+
+    m_wake.notify_all();
+
+    for (auto &thread : m_threads)
+      thread.join();
+
+    m_threads.clear();
+  }
+
+private:
+  void worker_loop() {
+    while (true) {
+      std::function<void()> job;
+
+      {
+        std::unique_lock lock(m_mutex);
+        m_wake.wait(lock, [&] { return m_stopping || !m_jobs.empty(); });
+
+        if (m_stopping)
+          return;
+
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+      }
+
+      job();
+    }
+  }
+
+  VulkanLogicalDevice m_logical_device;
+  VulkanPipelineCache *m_cache = nullptr;
+
+  std::vector<std::thread> m_threads;
+  std::deque<std::function<void()>> m_jobs;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_stopping = false;
+};
+
+} // namespace zephyr
@@ -66,6 +66,15 @@ public:
     return submit_info;
   }
 
+  static VkSubmitInfo declare_submit(const VkCommandBuffer &handle) {
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &handle;
+
+    return submit_info;
+  }
+
   static void submit(VkQueue queue,
                      std::vector<VkCommandBuffer> &command_buffers,
                      bool wait_idle = false, VkFence fence = VK_NULL_HANDLE) {
@@ -6,6 +6,8 @@
 namespace zephyr {
 
 static const VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+static const VkClearValue clear_depth = {.depthStencil = {1.0f, 0}};
+static const VkClearValue clear_values[] = {clear_color, clear_depth};
 
 class VulkanRenderPass {
 public:
@@ -13,7 +15,8 @@ public:
   VulkanRenderPass(VkRenderPass handle) : handle(handle) {}
 
   static VulkanRenderPass create(const VulkanSwapChain swap_chain,
-                                 const VulkanLogicalDevice logical_device) {
+                                 const VulkanLogicalDevice logical_device,
+                                 VkFormat depth_format) {
     VkRenderPass render_pass_handle;
 
     VkAttachmentDescription color_attachment{};
@@ -32,28 +35,61 @@ public:
     color_attachment_ref.attachment = 0;
     color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    // Depth is cleared on load and stored. Without the pre-pass, the Hi-Z
+    // pyramid is built from it once this pass ends.
+    VkAttachmentDescription depth_attachment{};
+
+    depth_attachment.format = depth_format;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depth_attachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depth_attachment_ref{};
+    depth_attachment_ref.attachment = 1;
+    depth_attachment_ref.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &color_attachment_ref;
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
 
     VkSubpassDependency subpass_dependency{};
     subpass_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     subpass_dependency.dstSubpass = 0;
 
+    // One depth image is shared by every frame in flight, so the previous
+    // frame's depth writes and Hi-Z reads have to finish before this one
+    // clears it.
     subpass_dependency.srcStageMask =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpass_dependency.srcAccessMask = 0;
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    subpass_dependency.srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
     subpass_dependency.dstStageMask =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpass_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    subpass_dependency.dstAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
     VkRenderPassCreateInfo render_pass_info{};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount = 1;
-    render_pass_info.pAttachments = &color_attachment;
+    VkAttachmentDescription attachments[] = {color_attachment,
+                                             depth_attachment};
+
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
     render_pass_info.subpassCount = 1;
     render_pass_info.pSubpasses = &subpass;
     render_pass_info.dependencyCount = 1;
@@ -66,6 +102,80 @@ public:
     return VulkanRenderPass(render_pass_handle);
   }
 
+  // Renders occluders into the depth buffer ahead of the main pass so the
+  // Hi-Z pyramid can be built from this frame's depth.
+  static VulkanRenderPass
+  create_depth_only(const VulkanLogicalDevice logical_device,
+                    VkFormat depth_format) {
+    VkRenderPass render_pass_handle;
+
+    // Stored, because the Hi-Z pass reads it right after this one.
+    VkAttachmentDescription depth_attachment{};
+
+    depth_attachment.format = depth_format;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depth_attachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depth_attachment_ref{};
+    depth_attachment_ref.attachment = 0;
+    depth_attachment_ref.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    VkSubpassDependency subpass_dependency{};
+    subpass_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    subpass_dependency.dstSubpass = 0;
+
+    subpass_dependency.srcStageMask =
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    subpass_dependency.srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    subpass_dependency.dstStageMask =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpass_dependency.dstAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 1;
+    render_pass_info.pAttachments = &depth_attachment;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 1;
+    render_pass_info.pDependencies = &subpass_dependency;
+
+    ZEPH_ENSURE(vkCreateRenderPass(logical_device.handle, &render_pass_info,
+                                   nullptr, &render_pass_handle) != VK_SUCCESS,
+                "Couldn't create depth-only render pass");
+
+    return VulkanRenderPass(render_pass_handle);
+  }
+
+  static VkRenderPassBeginInfo declare_begin_depth_only(
+      VkRenderPass render_pass, VkFramebuffer framebuffer,
+      VkExtent2D render_area_extent) {
+    VkRenderPassBeginInfo render_pass_info =
+        declare_begin(render_pass, framebuffer, render_area_extent);
+
+    render_pass_info.clearValueCount = 1;
+    render_pass_info.pClearValues = &clear_depth;
+
+    return render_pass_info;
+  }
+
   static VkRenderPassBeginInfo declare_begin(VkRenderPass render_pass,
                                              VkFramebuffer framebuffer,
                                              VkExtent2D render_area_extent) {
@@ -78,8 +188,8 @@ public:
     render_pass_info.renderArea.offset = {0, 0};
     render_pass_info.renderArea.extent = render_area_extent;
 
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues = &clear_color;
+    render_pass_info.clearValueCount = 2;
+    render_pass_info.pClearValues = clear_values;
 
     return render_pass_info;
   }
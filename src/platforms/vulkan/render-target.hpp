@@ -1,20 +1,32 @@
 #pragma once
 
 #include "entity.hpp"
+#include "material.hpp"
 #include "mesh.hpp"
 #include "platforms/vulkan/buffer.hpp"
 #include "platforms/vulkan/command-buffer.hpp"
 #include "platforms/vulkan/command-pool.hpp"
+#include "platforms/vulkan/culling-pass.hpp"
+#include "platforms/vulkan/descriptor-allocator.hpp"
 #include "platforms/vulkan/descriptor-set.hpp"
 #include "platforms/vulkan/device.hpp"
 #include "platforms/vulkan/fence.hpp"
+#include "platforms/vulkan/frame-graph.hpp"
+#include "platforms/vulkan/frame-ring.hpp"
 #include "platforms/vulkan/graphics-pipeline.hpp"
+#include "platforms/vulkan/hiz-pass.hpp"
 #include "platforms/vulkan/image.hpp"
 #include "platforms/vulkan/instance.hpp"
+#include "platforms/vulkan/mesh-registry.hpp"
+#include "platforms/vulkan/parallel-recorder.hpp"
+#include "platforms/vulkan/pipeline-cache.hpp"
+#include "platforms/vulkan/pipeline-compiler.hpp"
 #include "platforms/vulkan/render-pass.hpp"
 #include "platforms/vulkan/semaphore.hpp"
 #include "platforms/vulkan/surface.hpp"
 #include "platforms/vulkan/swap-chain.hpp"
+#include "platforms/vulkan/texture-table.hpp"
+#include "render-queue.hpp"
 #include "window.hpp"
 #include <iterator>
 #include <regex>
@@ -56,29 +68,93 @@ public:
     m_physical_device = VulkanPhysicalDevicePicker::pick(m_instance, m_surface);
     m_logical_device = VulkanLogicalDevice::create(m_physical_device);
 
+    m_pipeline_cache.init(m_logical_device, m_physical_device,
+                          "cache/pipelines.bin");
+    m_pipeline_compiler.init(m_logical_device, &m_pipeline_cache,
+                             MAX_COMPILE_THREADS);
+
     m_swap_chain = VulkanSwapChain::create(window, m_physical_device,
                                            m_logical_device, m_surface);
 
     VulkanSwapChain::create_image_views(m_logical_device.handle, m_swap_chain);
 
-    m_render_pass = VulkanRenderPass::create(m_swap_chain, m_logical_device);
+    m_depth_format = VulkanPhysicalDevice::find_depth_format(
+        m_physical_device.handle);
+    create_depth_image();
+
+    m_render_pass = VulkanRenderPass::create(m_swap_chain, m_logical_device,
+                                             m_depth_format);
+
+    m_descriptor_allocator.init(m_logical_device, MAX_FRAMES_IN_FLIGHT);
+    m_descriptor_set_layout = m_descriptor_allocator.layouts().get(
+        VulkanDescriptorSetLayout::frame_bindings(0, 1));
+    m_texture_table.init(m_logical_device, m_physical_device,
+                         m_descriptor_allocator.layouts());
 
-    m_descriptor_set_layout =
-        VulkanDescriptorSetLayout::create(0, 1, m_logical_device);
+    // Opaque and alpha-tested draws write depth without blending, so hidden
+    // fragments are rejected early. Transparent draws blend over them and
+    // test against their depth without writing it.
+    m_opaque_pipeline = m_pipeline_compiler.compile(
+        m_swap_chain, m_descriptor_set_layout, m_render_pass,
+        {
+            .vert_path = "assets/shaders/shader.vert.spv",
+            .frag_path = "assets/shaders/shader.frag.spv",
+            .depth_test = true,
+            .depth_write = true,
+            .owns_render_pass = false,
+            .secondary_set_layout = m_texture_table.layout().handle(),
+        });
+
+    m_alpha_tested_pipeline = m_pipeline_compiler.compile(
+        m_swap_chain, m_descriptor_set_layout, m_render_pass,
+        {
+            .vert_path = "assets/shaders/shader.vert.spv",
+            .frag_path = "assets/shaders/shader.cutout.frag.spv",
+            .depth_test = true,
+            .depth_write = true,
+            .owns_render_pass = false,
+            .secondary_set_layout = m_texture_table.layout().handle(),
+        });
 
-    m_graphics_pipeline = VulkanGraphicsPipeline::create(
-        m_logical_device, m_swap_chain, m_descriptor_set_layout, m_render_pass,
+    m_transparent_pipeline = m_pipeline_compiler.compile(
+        m_swap_chain, m_descriptor_set_layout, m_render_pass,
         {
             .vert_path = "assets/shaders/shader.vert.spv",
             .frag_path = "assets/shaders/shader.frag.spv",
             .alpha_blend = true,
+            .depth_test = true,
+            .depth_write = false,
+            .owns_render_pass = false,
+            .secondary_set_layout = m_texture_table.layout().handle(),
+        });
+
+    m_prepass_render_pass =
+        VulkanRenderPass::create_depth_only(m_logical_device, m_depth_format);
+
+    m_prepass_pipeline = m_pipeline_compiler.compile(
+        m_swap_chain, m_descriptor_set_layout, m_prepass_render_pass,
+        {
+            .vert_path = "assets/shaders/shader.vert.spv",
+            .frag_path = {},
+            .depth_test = true,
+            .depth_write = true,
+            .owns_render_pass = false,
+            .secondary_set_layout = m_texture_table.layout().handle(),
         });
 
     VulkanSwapChain::create_framebuffers(m_logical_device, m_swap_chain,
-                                         m_render_pass);
+                                         m_render_pass,
+                                         m_depth_image.image_view.handle);
+    create_prepass_framebuffer();
+
+    m_hiz.init(m_logical_device, m_physical_device,
+               m_descriptor_allocator.layouts(), &m_pipeline_cache);
+    m_hiz.resize(m_depth_image.image_view.handle, m_swap_chain.extent);
 
     m_command_pool =
         VulkanCommandPool::make(m_logical_device, m_physical_device);
+
+    m_mesh_registry.init(m_logical_device, m_physical_device, m_command_pool);
   }
 
   void cleanup_semaphores() {
@@ -106,6 +182,10 @@ public:
     m_swap_chain.framebuffers.clear();
     m_swap_chain.image_views.clear();
 
+    vkDestroyFramebuffer(m_logical_device.handle, m_prepass_framebuffer,
+                         nullptr);
+    m_depth_image.cleanup();
+
     cleanup_semaphores();
 
     m_swap_chain = VulkanSwapChain::create(
@@ -113,8 +193,18 @@ public:
 
     VulkanSwapChain::create_image_views(m_logical_device.handle, m_swap_chain);
 
+    create_depth_image();
+
     VulkanSwapChain::create_framebuffers(m_logical_device, m_swap_chain,
-                                         m_render_pass);
+                                         m_render_pass,
+                                         m_depth_image.image_view.handle);
+    create_prepass_framebuffer();
+
+    m_hiz.resize(m_depth_image.image_view.handle, m_swap_chain.extent);
+    m_hiz_valid = false;
+
+    if (m_gpu_culling)
+      m_culling.write_hiz(m_hiz.view(), m_hiz.sampler());
 
     create_semaphores();
 
@@ -127,204 +217,646 @@ public:
     }
   }
 
-  void create_vertex_buffer(std::vector<Vertex> vertices) {
-    VkDeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
+  MeshHandle register_mesh(MeshAsset mesh) {
+    return m_mesh_registry.add(std::move(mesh));
+  }
 
-    auto staging_buffer = VulkanBuffer::TransientStagingRegion::make(
-        m_logical_device, buffer_size,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+  void upload_meshes() { m_mesh_registry.upload(); }
+
+  template <typename G, typename O>
+  void setup_uniform_buffers(size_t object_count) {
+    m_object_capacity = std::max<size_t>(object_count, 1);
+
+    m_uniform_ring.init(m_logical_device, m_physical_device,
+                        MAX_FRAMES_IN_FLIGHT,
+                        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                            VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+    m_global_range = sizeof(G);
+    m_object_stride = sizeof(O);
+    m_object_range = m_object_capacity * m_object_stride;
+    m_instance_range = m_object_capacity * sizeof(uint32_t);
+    m_indirect_range =
+        m_object_capacity * sizeof(VkDrawIndexedIndirectCommand);
+    m_cull_range = m_object_capacity * sizeof(CullInstance);
+
+    m_uniform_ring.reserve(frame_ring_capacity());
+    m_descriptor_generations.assign(MAX_FRAMES_IN_FLIGHT, m_object_generation);
+    m_descriptor_sets.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    m_readbacks.assign(MAX_FRAMES_IN_FLIGHT, {});
+  }
 
-    staging_buffer.allocate(m_physical_device,
-                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  // GPU culling writes instance counts that are read back by indirect draws
+  // with a non-zero firstInstance, so it needs drawIndirectFirstInstance.
+  void setup_gpu_culling() {
+    if (!m_logical_device.enabled_features.drawIndirectFirstInstance) {
+      LOG_INFO("drawIndirectFirstInstance unsupported, culling on the CPU");
+      return;
+    }
 
-    staging_buffer.upload(vertices.data());
+    m_culling.init(m_logical_device, MAX_FRAMES_IN_FLIGHT,
+                   m_descriptor_allocator.layouts(), &m_pipeline_cache);
 
-    staging_buffer.unmap();
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+      m_culling.write(i, m_uniform_ring.buffer(i), culling_ranges());
 
-    m_vertex_region = VulkanBuffer::DeviceLocalRegion::make(
-        m_logical_device, buffer_size,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    m_culling.write_hiz(m_hiz.view(), m_hiz.sampler());
 
-    m_vertex_region.allocate(m_physical_device,
-                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_gpu_culling = true;
+  }
 
-    m_vertex_region.copy_from(&staging_buffer, m_logical_device.graphics_queue,
-                              m_command_pool);
+  // Draws occluders into the depth buffer before culling, so the Hi-Z
+  // pyramid reflects this frame instead of the last one. Off by default:
+  // it costs a second pass over the occluders' geometry.
+  void set_depth_prepass(bool enabled) { m_depth_prepass = enabled; }
 
-    staging_buffer.cleanup();
+  void set_occlusion_culling(bool enabled) { m_occlusion_culling = enabled; }
+
+  // Hi-Z level read back from an earlier frame, for culling on the CPU when
+  // the GPU can't. Null when there is nothing to test against.
+  const OcclusionDepth *cpu_occlusion() const {
+    if (m_gpu_culling || !m_occlusion_culling || m_cpu_occlusion.empty())
+      return nullptr;
+
+    return &m_cpu_occlusion;
   }
 
-  void create_index_buffer(std::vector<VertexIndice> indices) {
-    VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
+  const CullStats &cull_stats() const { return m_cull_stats; }
+
+  // Must be called after the frame's fence wait. When more objects exist
+  // than the slot pool holds, the capacity grows geometrically and each frame
+  // moves to a larger buffer the next time it comes around, so a buffer is
+  // only replaced once the GPU is done with it and no frame waits on another.
+  void begin_uniform_upload(uint32_t current_frame, size_t object_count) {
+    collect_readback(current_frame);
+
+    if (object_count > m_object_capacity) {
+      m_object_capacity = std::max(object_count, m_object_capacity * 2);
+      m_object_range = m_object_capacity * m_object_stride;
+      m_instance_range = m_object_capacity * sizeof(uint32_t);
+      m_indirect_range =
+          m_object_capacity * sizeof(VkDrawIndexedIndirectCommand);
+      m_cull_range = m_object_capacity * sizeof(CullInstance);
+      m_object_generation++;
+
+      REPORT_METRIC("renderer", "object_slot_capacity", m_object_capacity);
+    }
 
-    auto staging_buffer = VulkanBuffer::TransientStagingRegion::make(
-        m_logical_device, buffer_size,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    if (m_descriptor_generations[current_frame] != m_object_generation) {
+      // Recreates the frame's buffer without copying the old contents. That
+      // is safe because every frame pushes its uniforms, object slots,
+      // instances and indirect commands from scratch after this call.
+      m_uniform_ring.reserve(current_frame, frame_ring_capacity());
 
-    staging_buffer.allocate(m_physical_device,
-                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      if (m_gpu_culling)
+        m_culling.write(current_frame, m_uniform_ring.buffer(current_frame),
+                        culling_ranges());
 
-    staging_buffer.upload(indices.data());
-    staging_buffer.unmap();
+      m_descriptor_generations[current_frame] = m_object_generation;
+    }
 
-    m_index_region = VulkanBuffer::DeviceLocalRegion::make(
-        m_logical_device, buffer_size,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    m_uniform_ring.begin_frame(current_frame);
 
-    m_index_region.allocate(m_physical_device,
-                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    // The frame's set is allocated fresh from pools reset in one call, so a
+    // grown buffer needs no bookkeeping beyond the write.
+    m_descriptor_allocator.begin_frame(current_frame);
+    m_descriptor_sets[current_frame] =
+        m_descriptor_allocator.allocate(m_descriptor_set_layout);
 
-    m_index_region.copy_from(&staging_buffer, m_logical_device.graphics_queue,
-                             m_command_pool);
+    VulkanDescriptorSet::write(m_logical_device,
+                               m_descriptor_sets[current_frame],
+                               m_uniform_ring.buffer(current_frame),
+                               m_global_range, m_object_range,
+                               m_instance_range);
+  }
 
-    staging_buffer.cleanup();
+  template <typename T> void dispatch_global_uniform(const T &uniform) {
+    m_global_allocation = m_uniform_ring.push(uniform);
   }
 
-  template <typename T> void setup_uniform_buffer_slots(size_t slots_count) {
-    m_uniform_buffers_slots_count = slots_count;
+  // Copies the dense slot array in one go. The allocation always spans the
+  // whole object range so the dynamic descriptor stays in bounds.
+  template <typename T>
+  void dispatch_object_uniforms(const std::vector<T> &objects) {
+    m_object_allocation = m_uniform_ring.allocate(m_object_range, alignof(T));
 
-    VkPhysicalDeviceProperties props;
+    size_t count = std::min(objects.size(), m_object_capacity);
+    memcpy(m_object_allocation.data, objects.data(), count * sizeof(T));
+  }
 
-    vkGetPhysicalDeviceProperties(m_physical_device.handle, &props);
+  // Render slots in batch order. Every drawn entity holds a slot, so the
+  // instance list never outgrows the object capacity. With GPU culling the
+  // range is only reserved here and filled by the culling pass.
+  void dispatch_instances(const std::vector<uint32_t> &instances) {
+    m_instance_allocation =
+        m_uniform_ring.allocate(m_instance_range, alignof(uint32_t));
 
-    m_ubo_aligned_stride =
-        aligned_stride(sizeof(T), props.limits.minUniformBufferOffsetAlignment);
+    if (m_gpu_culling)
+      return;
 
-    VkDeviceSize buffer_size = slots_count * m_ubo_aligned_stride;
+    size_t count = std::min(instances.size(), m_object_capacity);
+    memcpy(m_instance_allocation.data, instances.data(),
+           count * sizeof(uint32_t));
+  }
 
-    m_uniform_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+  // Writes one indirect command per batch. A batch holds at least one
+  // entity, so there are never more commands than object slots.
+  template <typename B> void dispatch_draws(const std::vector<B> &batches) {
+    m_draw_count = static_cast<uint32_t>(
+        std::min(batches.size(), m_object_capacity));
+
+    m_indirect_allocation = m_uniform_ring.allocate(
+        m_draw_count * sizeof(VkDrawIndexedIndirectCommand),
+        alignof(VkDrawIndexedIndirectCommand));
+
+    auto *commands =
+        static_cast<VkDrawIndexedIndirectCommand *>(m_indirect_allocation.data);
+
+    for (uint32_t i = 0; i < m_draw_count; i++) {
+      ZEPH_ENSURE(!m_mesh_registry.owns(batches[i].mesh), "Batch ", i,
+                  " draws a mesh the registry doesn't hold");
+
+      commands[i].indexCount = batches[i].mesh.index_count;
+      commands[i].instanceCount =
+          m_gpu_culling ? 0 : batches[i].instance_count;
+      commands[i].firstIndex = batches[i].mesh.first_index;
+      commands[i].vertexOffset = batches[i].mesh.vertex_offset;
+      commands[i].firstInstance = batches[i].first_instance;
+    }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      auto buffer = VulkanBuffer::TransientStagingRegion::make(
-          m_logical_device, buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    // Commands stay in batch order because the culling shader addresses
+    // them by batch index; the queue only orders the submission.
+    m_render_queue.clear();
+    m_render_queue.push(RenderKey::make(PASS_BACKGROUND, PIPELINE_GRID, 0),
+                        GRID_DRAW);
 
-      buffer.allocate(m_physical_device,
-                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-      buffer.map();
+    // Opaque and alpha-tested draws sort front to back and transparent ones
+    // back to front. The batcher already emits batches in that order, which
+    // keeps their commands contiguous.
+    for (uint32_t i = 0; i < m_draw_count; i++)
+      m_render_queue.push(queue_key(batches[i]), i);
 
-      m_uniform_buffers[i] = buffer;
-    }
+    m_render_queue.sort();
   }
 
-  void create_descriptor_pool() {
-    m_descriptor_pool =
-        VulkanDescriptorPool::create(m_uniform_buffers.size(), m_logical_device)
-            .handle;
+  template <typename C>
+  void dispatch_cull_instances(const std::vector<C> &instances,
+                               const glm::mat4 &view_projection) {
+    m_view_projection = view_projection;
+
+    if (!m_gpu_culling)
+      return;
+
+    m_cull_count =
+        static_cast<uint32_t>(std::min(instances.size(), m_object_capacity));
+    m_cull_frustum = CullFrustum::from(view_projection);
+
+    m_cull_allocation = m_uniform_ring.allocate(m_cull_range, alignof(C));
+    memcpy(m_cull_allocation.data, instances.data(), m_cull_count * sizeof(C));
+
+    // With the pre-pass the pyramid is rebuilt from this frame's occluders
+    // before culling; otherwise it is last frame's, seen from last frame's
+    // camera.
+    CullParams params{};
+    params.occlusion = m_occlusion_culling && (m_depth_prepass || m_hiz_valid);
+    params.occlusion_view_projection =
+        m_depth_prepass ? view_projection : m_hiz_view_projection;
+    params.hiz_size = glm::vec2(m_hiz.extent().width, m_hiz.extent().height);
+    params.hiz_levels = m_hiz.levels();
+
+    m_cull_params_allocation = m_uniform_ring.push(params);
+    m_readbacks[m_upload_frame].params = m_cull_params_allocation;
   }
 
-  template <typename T> void setup_descriptor_sets() {
-
-    m_descriptor_sets =
-        VulkanDescriptorSet::create<T>(
-            m_logical_device, m_descriptor_set_layout, m_descriptor_pool,
-            m_uniform_buffers, m_texture_region.image_view,
-            m_texture_region.sampler)
-            .handles();
+  // Occluder batches for the depth pre-pass, with their own instance list.
+  template <typename B>
+  void dispatch_occluders(const std::vector<B> &batches,
+                          const std::vector<uint32_t> &instances) {
+    m_occluder_draws.clear();
+
+    if (!m_depth_prepass || !m_occlusion_culling)
+      return;
+
+    m_occluder_allocation =
+        m_uniform_ring.allocate(m_instance_range, alignof(uint32_t));
+
+    size_t count = std::min(instances.size(), m_object_capacity);
+    memcpy(m_occluder_allocation.data, instances.data(),
+           count * sizeof(uint32_t));
+
+    for (auto &batch : batches) {
+      if (batch.first_instance + batch.instance_count > count)
+        break;
+
+      VkDrawIndexedIndirectCommand draw{};
+      draw.indexCount = batch.mesh.index_count;
+      draw.instanceCount = batch.instance_count;
+      draw.firstIndex = batch.mesh.first_index;
+      draw.vertexOffset = batch.mesh.vertex_offset;
+      draw.firstInstance = batch.first_instance;
+      m_occluder_draws.push_back(draw);
+    }
   }
 
-  template <typename T>
-  void dispatch_uniform_buffer(T uniform, uint32_t slot,
-                               uint32_t current_frame) {
-
-    auto *dst = static_cast<char *>(m_uniform_buffers[current_frame].mapped) +
-                slot * m_ubo_aligned_stride;
-
-    memcpy(dst, &uniform, sizeof(uniform));
-  }
+  void flush_uniforms() { m_uniform_ring.flush(); }
 
   void create_command_buffers() {
     m_command_pool.allocate(MAX_FRAMES_IN_FLIGHT);
+
+    m_recorder.init(m_logical_device, m_physical_device, MAX_FRAMES_IN_FLIGHT,
+                    std::clamp(std::thread::hardware_concurrency(), 1u,
+                               MAX_RECORDING_THREADS));
+
+    m_frame_graphs.resize(MAX_FRAMES_IN_FLIGHT);
+    for (auto &graph : m_frame_graphs)
+      graph.init(m_logical_device, m_physical_device);
   }
 
-  void begin_frame(VkCommandBuffer command_buffer, uint32_t image_index) {
+  void begin_frame(VkCommandBuffer command_buffer, uint32_t image_index,
+                   uint32_t frame_index) {
 
     VulkanCommandBuffer::begin_command_buffer(command_buffer);
 
-    VkRenderPassBeginInfo render_pass_info = VulkanRenderPass::declare_begin(
-        m_render_pass.handle, m_swap_chain.framebuffers[image_index],
-        m_swap_chain.extent);
+    m_frame_index = frame_index;
+    m_image_index = image_index;
+  }
+
+  // Declares the frame's passes and what each one reads and writes. The
+  // frame graph drops the passes nothing depends on and places the barriers
+  // between the rest.
+  void record_frame(VkCommandBuffer command_buffer) {
+    FrameGraph &graph = m_frame_graphs[m_frame_index];
+    graph.reset();
+
+    VkBuffer ring = m_uniform_ring.buffer(m_frame_index);
+
+    auto objects = graph.import_buffer("objects", ring,
+                                       m_object_allocation.offset,
+                                       m_object_allocation.size);
+    auto instances = graph.import_buffer("instances", ring,
+                                         m_instance_allocation.offset,
+                                         m_instance_allocation.size);
+    auto draws = graph.import_buffer("draws", ring,
+                                     m_indirect_allocation.offset,
+                                     m_indirect_allocation.size);
+    auto backbuffer = graph.import_image(
+        "backbuffer", m_swap_chain.images[m_image_index],
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+    auto depth = graph.import_image("depth", m_depth_image.image,
+                                    VK_IMAGE_ASPECT_DEPTH_BIT,
+                                    VK_IMAGE_LAYOUT_UNDEFINED);
+
+    // The pyramid carries over between frames: the previous frame built it
+    // and may have copied it out.
+    auto hiz = graph.import_image(
+        "hiz", m_hiz.image(), VK_IMAGE_ASPECT_COLOR_BIT,
+        m_hiz_valid ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED,
+        {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+         VK_ACCESS_SHADER_WRITE_BIT});
+
+    graph.mark_output(backbuffer);
+
+    bool prepass = m_occlusion_culling && m_depth_prepass;
+
+    if (prepass) {
+      auto occluders = graph.import_buffer("occluders", ring,
+                                           m_occluder_allocation.offset,
+                                           m_occluder_allocation.size);
+
+      graph
+          .add_pass("prepass",
+                    [this](VkCommandBuffer cmd) { record_prepass(cmd); })
+          .read(objects, {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                          VK_ACCESS_SHADER_READ_BIT})
+          .read(occluders, {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                            VK_ACCESS_SHADER_READ_BIT})
+          .write(depth, {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL})
+          .render_pass_transitions();
+
+      add_hiz_pass(graph, depth, hiz);
+    }
+
+    FrameGraphResource cull_params = 0;
+
+    if (m_gpu_culling) {
+      auto cull_instances = graph.import_buffer(
+          "cull_instances", ring, m_cull_allocation.offset,
+          m_cull_allocation.size);
+      cull_params = graph.import_buffer("cull_params", ring,
+                                        m_cull_params_allocation.offset,
+                                        m_cull_params_allocation.size);
+
+      graph
+          .add_pass("cull",
+                    [this](VkCommandBuffer cmd) {
+                      m_culling.record(
+                          cmd, m_frame_index,
+                          {.objects = m_object_allocation.offset,
+                           .instances = m_cull_allocation.offset,
+                           .draws = m_indirect_allocation.offset,
+                           .visible = m_instance_allocation.offset,
+                           .params = m_cull_params_allocation.offset},
+                          m_cull_frustum, m_cull_count);
+                    })
+          .read(objects, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                          VK_ACCESS_SHADER_READ_BIT})
+          .read(cull_instances, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_ACCESS_SHADER_READ_BIT})
+          .read(draws, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT})
+          .write(draws, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_ACCESS_SHADER_WRITE_BIT})
+          .write(instances, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_ACCESS_SHADER_WRITE_BIT})
+          .read(hiz, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL})
+          .write(cull_params, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_ACCESS_SHADER_READ_BIT |
+                                   VK_ACCESS_SHADER_WRITE_BIT});
+    }
+
+    graph
+        .add_pass("main",
+                  [this](VkCommandBuffer cmd) {
+                    VkRenderPassBeginInfo render_pass_info =
+                        VulkanRenderPass::declare_begin(
+                            m_render_pass.handle,
+                            m_swap_chain.framebuffers[m_image_index],
+                            m_swap_chain.extent);
+
+                    vkCmdBeginRenderPass(
+                        cmd, &render_pass_info,
+                        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+                    record_draws(cmd);
+
+                    vkCmdEndRenderPass(cmd);
+                  })
+        .read(objects, {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT})
+        .read(instances, {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                          VK_ACCESS_SHADER_READ_BIT})
+        .read(draws, {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                      VK_ACCESS_INDIRECT_COMMAND_READ_BIT})
+        .write(backbuffer, {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR})
+        .write(depth, {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                       VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL})
+        .render_pass_transitions();
+
+    if (m_occlusion_culling && !prepass)
+      add_hiz_pass(graph, depth, hiz);
+
+    // Without GPU culling the batcher tests against a coarse level of the
+    // pyramid, copied out once this frame's fence has been waited on.
+    FrameGraphResource depth_readback = 0;
+    bool cpu_readback = m_occlusion_culling && !m_gpu_culling;
+
+    if (cpu_readback) {
+      uint32_t level = m_hiz.level_within(READBACK_SIZE);
+      VkExtent2D extent = m_hiz.level_extent(level);
+
+      Readback &readback = m_readbacks[m_frame_index];
+      readback.depth = m_uniform_ring.allocate(
+          extent.width * extent.height * sizeof(float), alignof(float));
+      readback.depth_extent = extent;
+      readback.depth_view_projection = m_view_projection;
+
+      depth_readback = graph.import_buffer("depth_readback", ring,
+                                           readback.depth.offset,
+                                           readback.depth.size);
+
+      graph
+          .add_pass("hiz_readback",
+                    [this, level, extent,
+                     offset = readback.depth.offset](VkCommandBuffer cmd) {
+                      VkBufferImageCopy region{};
+                      region.bufferOffset = offset;
+                      region.imageSubresource.aspectMask =
+                          VK_IMAGE_ASPECT_COLOR_BIT;
+                      region.imageSubresource.mipLevel = level;
+                      region.imageSubresource.layerCount = 1;
+                      region.imageExtent = {extent.width, extent.height, 1};
+
+                      vkCmdCopyImageToBuffer(
+                          cmd, m_hiz.image(), VK_IMAGE_LAYOUT_GENERAL,
+                          m_uniform_ring.buffer(m_frame_index), 1, &region);
+                    })
+          .read(hiz, {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL})
+          .write(depth_readback, {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_ACCESS_TRANSFER_WRITE_BIT});
+    }
+
+    // Records nothing; it only carries the barrier that makes the device's
+    // writes visible to the host.
+    if (m_gpu_culling || cpu_readback) {
+      auto readback = graph.add_pass("readback", [](VkCommandBuffer) {});
+      readback.side_effect();
+
+      if (m_gpu_culling)
+        readback.read(cull_params,
+                      {VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT});
+
+      if (cpu_readback)
+        readback.read(depth_readback,
+                      {VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT});
+    }
+
+    graph.compile();
+    graph.execute(command_buffer);
+  }
+
+  // Builds the pyramid from whatever the depth buffer holds at this point
+  // and remembers the camera it was seen from.
+  void add_hiz_pass(FrameGraph &graph, FrameGraphResource depth,
+                    FrameGraphResource hiz) {
+    graph.add_pass("hiz", [this](VkCommandBuffer cmd) { m_hiz.record(cmd); })
+        .read(depth, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT,
+                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL})
+        .write(hiz, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_IMAGE_LAYOUT_GENERAL})
+        .side_effect();
+
+    m_hiz_view_projection = m_view_projection;
+    m_hiz_valid = true;
+  }
+
+  // Draws the occluders depth-only, one direct draw per batch: the indirect
+  // commands aren't filled until culling has run.
+  void record_prepass(VkCommandBuffer command_buffer) {
+    VkRenderPassBeginInfo render_pass_info =
+        VulkanRenderPass::declare_begin_depth_only(
+            m_prepass_render_pass.handle, m_prepass_framebuffer,
+            m_swap_chain.extent);
 
     vkCmdBeginRenderPass(command_buffer, &render_pass_info,
                          VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_graphics_pipeline.handle());
+    if (m_prepass_pipeline.ready() && !m_occluder_draws.empty()) {
+      const VulkanGraphicsPipeline &pipeline = m_prepass_pipeline.get();
 
-    VkViewport viewport{};
+      vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        pipeline.handle());
+      set_viewport(command_buffer);
 
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)m_swap_chain.extent.width;
-    viewport.height = (float)m_swap_chain.extent.height;
+      bind_sets(command_buffer, pipeline.layout(),
+                m_occluder_allocation.offset);
 
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+      m_mesh_registry.bind(command_buffer);
 
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+      for (auto &draw : m_occluder_draws)
+        vkCmdDrawIndexed(command_buffer, draw.indexCount, draw.instanceCount,
+                         draw.firstIndex, draw.vertexOffset,
+                         draw.firstInstance);
+    }
 
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = m_swap_chain.extent;
+    vkCmdEndRenderPass(command_buffer);
 
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    REPORT_METRIC("culling", "prepass_draws", m_occluder_draws.size());
   }
 
-  void draw_indexed(VkCommandBuffer command_buffer, Mesh mesh,
-                    uint32_t frame_index, uint32_t slot) {
-    VkBuffer vertex_buffers[] = {m_vertex_region.buffer};
-    VkDeviceSize offsets[] = {0};
+  // Reads what the device wrote for this frame slot last time around.
+  // The frame's fence has been waited on, and nothing has been allocated
+  // from its ring yet.
+  void collect_readback(uint32_t frame_index) {
+    m_upload_frame = frame_index;
 
-    vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+    Readback &readback = m_readbacks[frame_index];
+    if (!readback.params.data && !readback.depth.data)
+      return;
 
-    vkCmdBindIndexBuffer(command_buffer, m_index_region.buffer, 0,
-                         VK_INDEX_TYPE_UINT32);
+    m_uniform_ring.invalidate(frame_index);
 
-    auto dynamic_offset = static_cast<uint32_t>(slot * m_ubo_aligned_stride);
+    if (readback.params.data) {
+      m_cull_stats =
+          static_cast<const CullParams *>(readback.params.data)->stats;
 
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_graphics_pipeline.layout(), 0, 1,
-                            &m_descriptor_sets[frame_index], 1,
-                            &dynamic_offset);
+      REPORT_METRIC("culling", "instances_tested", m_cull_stats.tested);
+      REPORT_METRIC("culling", "frustum_culled", m_cull_stats.frustum_culled);
+      REPORT_METRIC("culling", "occlusion_culled",
+                    m_cull_stats.occlusion_culled);
+    }
+
+    if (readback.depth.data) {
+      VkExtent2D extent = readback.depth_extent;
 
-    vkCmdDrawIndexed(command_buffer, static_cast<uint32_t>(mesh.indices.size()),
-                     1, 0, 0, 0);
+      m_cpu_occlusion.width = extent.width;
+      m_cpu_occlusion.height = extent.height;
+      m_cpu_occlusion.view_projection = readback.depth_view_projection;
+      m_cpu_occlusion.depth.resize(extent.width * extent.height);
+      memcpy(m_cpu_occlusion.depth.data(), readback.depth.data,
+             m_cpu_occlusion.depth.size() * sizeof(float));
+    }
+
+    readback = {};
+  }
+
+  // Records the sorted render queue into secondary buffers, in parallel over
+  // slices of the queue, and executes them in slice order. A multi-draw
+  // covers any number of commands in one call, so the queue is only split
+  // when draws are recorded one by one.
+  void record_draws(VkCommandBuffer command_buffer) {
+    const VkPhysicalDeviceFeatures &features =
+        m_logical_device.enabled_features;
+    bool multi_draw =
+        features.multiDrawIndirect && features.drawIndirectFirstInstance;
+
+    uint32_t item_count = static_cast<uint32_t>(m_render_queue.size());
+
+    VkCommandBufferInheritanceInfo inheritance{};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass = m_render_pass.handle;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = m_swap_chain.framebuffers[m_image_index];
+
+    uint32_t min_slice =
+        multi_draw ? std::max(item_count, 1u) : MIN_DRAWS_PER_SLICE;
+
+    m_slice_stats.assign(m_recorder.worker_count(), {});
+
+    auto &secondaries = m_recorder.record(
+        m_frame_index, inheritance, item_count, min_slice,
+        [this](VkCommandBuffer secondary, uint32_t slice, uint32_t first,
+               uint32_t count) {
+          set_viewport(secondary);
+          submit(secondary, first, count, m_slice_stats[slice]);
+        });
+
+    vkCmdExecuteCommands(command_buffer,
+                         static_cast<uint32_t>(secondaries.size()),
+                         secondaries.data());
+
+    m_queue_stats = {};
+    for (auto &stats : m_slice_stats)
+      m_queue_stats += stats;
+
+    REPORT_METRIC("renderer", "indirect_commands", m_draw_count);
+    REPORT_METRIC("renderer", "recorded_draw_calls", m_queue_stats.draw_calls);
+    REPORT_METRIC("renderer", "pipeline_binds", m_queue_stats.pipeline_binds);
+    REPORT_METRIC("renderer", "descriptor_binds",
+                  m_queue_stats.descriptor_binds);
+    REPORT_METRIC("renderer", "vertex_buffer_binds",
+                  m_queue_stats.vertex_buffer_binds);
+    REPORT_METRIC("renderer", "draws_skipped_pipeline_pending",
+                  m_queue_stats.skipped_draws);
+    REPORT_METRIC("renderer", "secondary_command_buffers", secondaries.size());
   }
 
   void setup_grid_pipeline() {
-    m_grid_pipeline = VulkanGraphicsPipeline::create(
-        m_logical_device, m_swap_chain, m_descriptor_set_layout, m_render_pass,
+    m_grid_pipeline = m_pipeline_compiler.compile(
+        m_swap_chain, m_descriptor_set_layout, m_render_pass,
         {.vert_path = "assets/shaders/grid.vert.spv",
          .frag_path = "assets/shaders/grid.frag.spv",
          .cull_mode = VK_CULL_MODE_NONE,
          .vertex_input = false,
          .alpha_blend = true,
-         .owns_render_pass = false});
+         .owns_render_pass = false,
+         .secondary_set_layout = m_texture_table.layout().handle()});
   }
 
-  void draw(VkCommandBuffer command_buffer, uint32_t frame_index,
-            uint32_t slot) {
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_grid_pipeline.handle());
-
-    auto dynamic_offset = static_cast<uint32_t>(slot * m_ubo_aligned_stride);
-
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_grid_pipeline.layout(), 0, 1,
-                            &m_descriptor_sets[frame_index], 1,
-                            &dynamic_offset);
-
-    vkCmdDraw(command_buffer, 3, 1, 0, 0);
+  // Sized to the swap chain, so it is rebuilt whenever the chain is. The
+  // Hi-Z pass samples it.
+  void create_depth_image() {
+    m_depth_image = VulkanBuffer::VulkanImageRegion::make(
+        m_logical_device, m_swap_chain.extent.width,
+        m_swap_chain.extent.height, m_depth_format, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_SAMPLED_BIT);
+
+    m_depth_image.allocate(m_physical_device,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           VK_IMAGE_ASPECT_DEPTH_BIT);
+  }
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_graphics_pipeline.handle());
+  // The pre-pass writes the same depth image the main pass then clears.
+  void create_prepass_framebuffer() {
+    VkFramebufferCreateInfo framebuffer_info{};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.width = m_swap_chain.extent.width;
+    framebuffer_info.height = m_swap_chain.extent.height;
+    framebuffer_info.renderPass = m_prepass_render_pass.handle;
+    framebuffer_info.pAttachments = &m_depth_image.image_view.handle;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.layers = 1;
+
+    ZEPH_ENSURE(vkCreateFramebuffer(m_logical_device.handle, &framebuffer_info,
+                                    nullptr,
+                                    &m_prepass_framebuffer) != VK_SUCCESS,
+                "Couldn't create pre-pass framebuffer");
   }
 
   void end_frame(VkCommandBuffer command_buffer) {
-    vkCmdEndRenderPass(command_buffer);
-
     VulkanCommandBuffer::end_command_buffer(command_buffer);
   }
 
@@ -364,7 +896,9 @@ public:
     }
   }
 
-  void create_texture_image(std::string path) {
+  // Loads a texture into the texture table and returns its index, which is
+  // what MaterialComponent::texture refers to.
+  uint32_t create_texture_image(std::string path) {
     int texture_width, texture_height, texture_channel;
 
     stbi_uc *pixels = stbi_load(path.c_str(), &texture_width, &texture_height,
@@ -383,49 +917,77 @@ public:
     staging_buffer.upload(pixels);
     staging_buffer.unmap();
 
+    BlendMode blend = classify_alpha(
+        pixels, static_cast<size_t>(texture_width) * texture_height);
+    LOG_INFO("Texture", path, "classified as", blend_mode_name(blend));
+
     stbi_image_free(pixels);
 
-    m_texture_region = VulkanBuffer::VulkanImageRegion::make(
+    auto texture_region = VulkanBuffer::VulkanImageRegion::make(
         m_logical_device, texture_width, texture_height,
         VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 
-    m_texture_region.allocate(m_physical_device,
-                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    texture_region.allocate(m_physical_device,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    m_texture_region.transition_layout(m_logical_device.graphics_queue,
-                                       m_command_pool,
-                                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    texture_region.transition_layout(m_logical_device.graphics_queue,
+                                     m_command_pool,
+                                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-    m_texture_region.copy_to_image(
+    texture_region.copy_to_image(
         staging_buffer, m_logical_device.graphics_queue, m_command_pool);
 
-    m_texture_region.transition_layout(
-        m_logical_device.graphics_queue, m_command_pool,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    texture_region.transition_layout(m_logical_device.graphics_queue,
+                                     m_command_pool,
+                                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
     staging_buffer.cleanup();
+
+    uint32_t index = m_texture_table.add(texture_region.image_view.handle,
+                                         texture_region.sampler.handle);
+
+    m_textures.push_back(texture_region);
+    m_texture_blends.push_back(blend);
+
+    return index;
   }
 
   void cleanup() {
+    m_pipeline_compiler.cleanup();
+
     m_swap_chain.cleanup();
+    m_depth_image.cleanup();
 
-    m_texture_region.cleanup();
-    m_vertex_region.cleanup();
-    m_index_region.cleanup();
+    for (auto &texture : m_textures)
+      texture.cleanup();
+    m_texture_table.cleanup();
+    m_mesh_registry.cleanup();
 
-    vkDestroyDescriptorPool(m_logical_device.handle, m_descriptor_pool,
-                            nullptr);
+    m_uniform_ring.cleanup();
 
-    m_descriptor_set_layout.cleanup();
+    if (m_gpu_culling)
+      m_culling.cleanup();
 
-    for (auto uniform_buffer : m_uniform_buffers) {
-      uniform_buffer.unmap();
-      uniform_buffer.cleanup();
-    }
+    m_hiz.cleanup();
+
+    // Owns every set layout, so it goes after their users.
+    m_descriptor_allocator.cleanup();
+
+    vkDestroyFramebuffer(m_logical_device.handle, m_prepass_framebuffer,
+                         nullptr);
+    m_prepass_pipeline.cleanup();
+    vkDestroyRenderPass(m_logical_device.handle, m_prepass_render_pass.handle,
+                        nullptr);
 
     m_grid_pipeline.cleanup();
-    m_graphics_pipeline.cleanup();
+    m_opaque_pipeline.cleanup();
+    m_alpha_tested_pipeline.cleanup();
+    m_transparent_pipeline.cleanup();
+    vkDestroyRenderPass(m_logical_device.handle, m_render_pass.handle, nullptr);
+
+    m_pipeline_cache.save();
+    m_pipeline_cache.cleanup();
 
     cleanup_semaphores();
 
@@ -433,6 +995,10 @@ public:
       vkDestroyFence(m_logical_device.handle, m_in_flight_fences[i], nullptr);
     }
 
+    for (auto &graph : m_frame_graphs)
+      graph.cleanup();
+
+    m_recorder.cleanup();
     m_command_pool.cleanup();
 
     m_logical_device.cleanup();
@@ -441,19 +1007,23 @@ public:
     m_instance.cleanup();
   };
 
-  VulkanLogicalDevice logical_device() const { return m_logical_device; }
-  VulkanSwapChain swap_chain() const { return m_swap_chain; }
-  std::vector<VkFence> in_flight_fences() { return m_in_flight_fences; }
+  const VulkanLogicalDevice &logical_device() const {
+    return m_logical_device;
+  }
+  const VulkanSwapChain &swap_chain() const { return m_swap_chain; }
+  const std::vector<VkFence> &in_flight_fences() const {
+    return m_in_flight_fences;
+  }
 
-  std::vector<VkCommandBuffer> command_buffers() {
+  const std::vector<VkCommandBuffer> &command_buffers() const {
     return m_command_pool.commands;
   }
 
-  std::vector<VkSemaphore> image_available_semaphores() {
+  const std::vector<VkSemaphore> &image_available_semaphores() const {
     return m_image_available_semaphores;
   }
 
-  std::vector<VkSemaphore> render_finished_semaphores() {
+  const std::vector<VkSemaphore> &render_finished_semaphores() const {
     return m_render_finished_semaphores;
   }
 
@@ -461,21 +1031,228 @@ public:
     return MAX_FRAMES_IN_FLIGHT;
   }
 
-  inline std::vector<VulkanBuffer::TransientStagingRegion> constexpr &
-  uniform_buffers() {
-    return m_uniform_buffers;
+  const FrameRingStats &uniform_upload_stats() const {
+    return m_uniform_ring.stats();
+  }
+
+  const RenderQueueStats &render_queue_stats() const { return m_queue_stats; }
+
+  // Blend mode a texture's alpha calls for; texture 0's is the default for
+  // entities without a MaterialComponent.
+  BlendMode texture_blend_mode(uint32_t texture = 0) const {
+    if (texture >= m_texture_blends.size())
+      return BlendMode::OPAQUE;
+
+    return m_texture_blends[texture];
+  }
+
+  // A material sampling `texture`, blended the way the texture's alpha was
+  // classified when it loaded. Use this rather than filling in
+  // MaterialComponent by hand, so the blend mode can't disagree with the
+  // texture.
+  MaterialComponent make_material(uint32_t texture) const {
+    return {.blend = texture_blend_mode(texture), .texture = texture};
   }
 
 private:
-  static VkDeviceSize aligned_stride(VkDeviceSize size, VkDeviceSize aligment) {
-    return (size + aligment - 1) & ~(aligment - 1);
+  // Records queue items [first, first + count), binding only the state that
+  // differs from the previous item. Secondaries inherit nothing from the
+  // primary, so tracking starts empty in each of them. Adjacent mesh items
+  // with consecutive commands collapse into one indirect submission, and
+  // items whose pipeline is still compiling are skipped for this frame.
+  void submit(VkCommandBuffer command_buffer, uint32_t first, uint32_t count,
+              RenderQueueStats &stats) {
+    const auto &items = m_render_queue.items();
+
+    uint32_t bound_pipeline = NO_BINDING;
+    bool sets_bound = false;
+    bool mesh_buffers_bound = false;
+
+    for (uint32_t i = first, end = first + count; i < end;) {
+      uint64_t key = items[i].key;
+      uint32_t pipeline_id = RenderKey::pipeline(key);
+      const VulkanPipelineHandle &pipeline = pipeline_for(pipeline_id);
+
+      uint32_t run = 1;
+      if (pipeline_id != PIPELINE_GRID) {
+        while (i + run < end &&
+               items[i + run].key >> RenderKey::PIPELINE_SHIFT ==
+                   key >> RenderKey::PIPELINE_SHIFT &&
+               items[i + run].draw == items[i].draw + run)
+          run++;
+      }
+
+      if (!pipeline.ready()) {
+        stats.skipped_draws += run;
+        i += run;
+        continue;
+      }
+
+      if (pipeline_id != bound_pipeline) {
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeline.get().handle());
+        bound_pipeline = pipeline_id;
+        stats.pipeline_binds++;
+      }
+
+      // Every pipeline shares the set layouts, so the sets bound for the
+      // first draw survive pipeline switches.
+      if (!sets_bound) {
+        bind_sets(command_buffer, pipeline.get().layout(),
+                  m_instance_allocation.offset);
+        sets_bound = true;
+        stats.descriptor_binds++;
+      }
+
+      if (pipeline_id == PIPELINE_GRID) {
+        vkCmdDraw(command_buffer, 3, 1, 0, 0);
+        stats.draw_calls++;
+      } else {
+        if (!mesh_buffers_bound) {
+          m_mesh_registry.bind(command_buffer);
+          mesh_buffers_bound = true;
+          stats.vertex_buffer_binds++;
+        }
+
+        stats.draw_calls += draw_indirect(command_buffer, items[i].draw, run);
+      }
+
+      i += run;
+    }
+  }
+
+  const VulkanPipelineHandle &pipeline_for(uint32_t pipeline_id) const {
+    switch (pipeline_id) {
+    case PIPELINE_GRID:
+      return m_grid_pipeline;
+    case PIPELINE_ALPHA_TESTED:
+      return m_alpha_tested_pipeline;
+    case PIPELINE_TRANSPARENT:
+      return m_transparent_pipeline;
+    default:
+      return m_opaque_pipeline;
+    }
+  }
+
+  template <typename B> static uint64_t queue_key(const B &batch) {
+    uint32_t depth = RenderKey::depth_bits(batch.depth);
+
+    switch (batch.blend) {
+    case BlendMode::ALPHA_TESTED:
+      return RenderKey::make(PASS_ALPHA_TESTED, PIPELINE_ALPHA_TESTED, depth);
+    case BlendMode::TRANSPARENT:
+      // Inverted so the farthest draw sorts first.
+      return RenderKey::make(PASS_TRANSPARENT, PIPELINE_TRANSPARENT,
+                             RenderKey::DEPTH_MAX - depth);
+    default:
+      return RenderKey::make(PASS_OPAQUE, PIPELINE_OPAQUE, depth);
+    }
+  }
+
+  // Set 0 is the frame's set, with the instance binding at
+  // `instance_offset`; set 1 is the texture table.
+  void bind_sets(VkCommandBuffer command_buffer,
+                 VkPipelineLayout pipeline_layout,
+                 VkDeviceSize instance_offset) {
+    uint32_t dynamic_offsets[] = {
+        static_cast<uint32_t>(m_global_allocation.offset),
+        static_cast<uint32_t>(m_object_allocation.offset),
+        static_cast<uint32_t>(instance_offset)};
+
+    VkDescriptorSet sets[] = {m_descriptor_sets[m_frame_index],
+                              m_texture_table.set()};
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipeline_layout, 0, 2, sets, 3, dynamic_offsets);
+  }
+
+  void set_viewport(VkCommandBuffer command_buffer) {
+    VkViewport viewport{};
+
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)m_swap_chain.extent.width;
+    viewport.height = (float)m_swap_chain.extent.height;
+
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = m_swap_chain.extent;
+
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+  }
+
+  // Submits indirect commands [first, first + count). With multiDrawIndirect
+  // this is a single call. Without it each command becomes its own indirect
+  // draw, and without drawIndirectFirstInstance the commands are replayed
+  // from the mapped ring as direct draws. Safe to call from worker threads.
+  // Returns the number of draw calls recorded.
+  uint32_t draw_indirect(VkCommandBuffer command_buffer, uint32_t first,
+                         uint32_t count) {
+    if (count == 0)
+      return 0;
+
+    const VkPhysicalDeviceFeatures &features =
+        m_logical_device.enabled_features;
+    constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize offset = m_indirect_allocation.offset + first * stride;
+
+    if (!features.drawIndirectFirstInstance) {
+      auto *commands = static_cast<const VkDrawIndexedIndirectCommand *>(
+                           m_indirect_allocation.data) +
+                       first;
+
+      for (uint32_t i = 0; i < count; i++) {
+        vkCmdDrawIndexed(command_buffer, commands[i].indexCount,
+                         commands[i].instanceCount, commands[i].firstIndex,
+                         commands[i].vertexOffset, commands[i].firstInstance);
+      }
+    } else if (features.multiDrawIndirect) {
+      vkCmdDrawIndexedIndirect(command_buffer, m_indirect_allocation.buffer,
+                               offset, count, stride);
+      return 1;
+    } else {
+      for (uint32_t i = 0; i < count; i++) {
+        vkCmdDrawIndexedIndirect(command_buffer, m_indirect_allocation.buffer,
+                                 offset + i * stride, 1, stride);
+      }
+    }
+
+    return count;
+  }
+
+  VkDeviceSize frame_ring_capacity() const {
+    return m_uniform_ring.aligned_size(m_global_range) +
+           m_uniform_ring.aligned_size(m_object_range) +
+           m_uniform_ring.aligned_size(m_instance_range) +
+           m_uniform_ring.aligned_size(m_indirect_range) +
+           m_uniform_ring.aligned_size(m_cull_range) +
+           m_uniform_ring.aligned_size(sizeof(CullParams)) +
+           m_uniform_ring.aligned_size(m_instance_range) +
+           m_uniform_ring.aligned_size(READBACK_SIZE * READBACK_SIZE *
+                                       sizeof(float));
+  }
+
+  VulkanCullingPass::Ranges culling_ranges() const {
+    return {.objects = m_object_range,
+            .instances = m_cull_range,
+            .draws = m_indirect_range,
+            .visible = m_instance_range};
   }
 
   VulkanInstance m_instance;
   VulkanPhysicalDevice m_physical_device;
   VulkanLogicalDevice m_logical_device;
-  VulkanGraphicsPipeline m_graphics_pipeline;
-  VulkanGraphicsPipeline m_grid_pipeline;
+  VulkanPipelineHandle m_opaque_pipeline;
+  VulkanPipelineHandle m_alpha_tested_pipeline;
+  VulkanPipelineHandle m_transparent_pipeline;
+  VulkanPipelineHandle m_grid_pipeline;
+  VulkanPipelineCache m_pipeline_cache;
+  VulkanPipelineCompiler m_pipeline_compiler;
   VulkanRenderPass m_render_pass;
   VulkanSurface m_surface;
   VulkanDescriptorSetLayout m_descriptor_set_layout;
@@ -488,19 +1265,95 @@ private:
   std::vector<VkFence> m_in_flight_fences;
 
   const uint8_t MAX_FRAMES_IN_FLIGHT = 2;
+  static constexpr uint32_t MAX_RECORDING_THREADS = 4;
+  static constexpr uint32_t MAX_COMPILE_THREADS = 2;
+  static constexpr uint32_t MIN_DRAWS_PER_SLICE = 64;
+
+  enum RenderPassOrder : uint32_t {
+    PASS_BACKGROUND,
+    PASS_OPAQUE,
+    PASS_ALPHA_TESTED,
+    PASS_TRANSPARENT
+  };
+  enum PipelineId : uint32_t {
+    PIPELINE_GRID,
+    PIPELINE_OPAQUE,
+    PIPELINE_ALPHA_TESTED,
+    PIPELINE_TRANSPARENT
+  };
+  static constexpr uint32_t GRID_DRAW = UINT32_MAX;
+  static constexpr uint32_t NO_BINDING = UINT32_MAX;
+
+  RenderQueue m_render_queue;
+  std::vector<RenderQueueStats> m_slice_stats;
+  RenderQueueStats m_queue_stats;
+
+  VulkanParallelRecorder m_recorder;
+  std::vector<FrameGraph> m_frame_graphs;
+  uint32_t m_frame_index = 0;
+  uint32_t m_image_index = 0;
+
+  VulkanMeshRegistry m_mesh_registry;
+
+  size_t m_object_capacity = 0;
+  VkDeviceSize m_global_range = 0;
+  VkDeviceSize m_object_range = 0;
+  VkDeviceSize m_instance_range = 0;
+  VkDeviceSize m_indirect_range = 0;
+  VkDeviceSize m_object_stride = 0;
+  uint32_t m_object_generation = 0;
+  std::vector<uint32_t> m_descriptor_generations;
+  VulkanFrameRing m_uniform_ring;
+  FrameRingAllocation m_global_allocation;
+  FrameRingAllocation m_object_allocation;
+  FrameRingAllocation m_instance_allocation;
+  FrameRingAllocation m_indirect_allocation;
+  uint32_t m_draw_count = 0;
+
+  VulkanCullingPass m_culling;
+  bool m_gpu_culling = false;
+  VkDeviceSize m_cull_range = 0;
+  FrameRingAllocation m_cull_allocation;
+  CullFrustum m_cull_frustum{};
+  uint32_t m_cull_count = 0;
+  FrameRingAllocation m_cull_params_allocation;
+  CullStats m_cull_stats;
+
+  // Device results of a frame slot, read after its fence has been waited on.
+  struct Readback {
+    FrameRingAllocation params;
+    FrameRingAllocation depth;
+    VkExtent2D depth_extent{};
+    glm::mat4 depth_view_projection{1.0f};
+  };
+
+  static constexpr uint32_t READBACK_SIZE = 64;
 
-  VulkanBuffer::DeviceLocalRegion m_vertex_region;
-  VulkanBuffer::DeviceLocalRegion m_index_region;
+  VulkanHiZPass m_hiz;
+  bool m_hiz_valid = false;
+  bool m_occlusion_culling = true;
+  glm::mat4 m_view_projection{1.0f};
+  glm::mat4 m_hiz_view_projection{1.0f};
+  std::vector<Readback> m_readbacks;
+  uint32_t m_upload_frame = 0;
+  OcclusionDepth m_cpu_occlusion;
 
-  VkDeviceSize m_ubo_aligned_stride = 0;
-  size_t m_uniform_buffers_slots_count = 0;
-  std::vector<VulkanBuffer::TransientStagingRegion> m_uniform_buffers;
+  bool m_depth_prepass = false;
+  VulkanRenderPass m_prepass_render_pass;
+  VkFramebuffer m_prepass_framebuffer = VK_NULL_HANDLE;
+  VulkanPipelineHandle m_prepass_pipeline;
+  FrameRingAllocation m_occluder_allocation;
+  std::vector<VkDrawIndexedIndirectCommand> m_occluder_draws;
 
-  VkDescriptorPool m_descriptor_pool;
+  VulkanDescriptorAllocator m_descriptor_allocator;
 
   std::vector<VkDescriptorSet> m_descriptor_sets;
 
-  VulkanBuffer::VulkanImageRegion m_texture_region;
+  VulkanTextureTable m_texture_table;
+  std::vector<VulkanBuffer::VulkanImageRegion> m_textures;
+  std::vector<BlendMode> m_texture_blends;
+  VulkanBuffer::VulkanImageRegion m_depth_image;
+  VkFormat m_depth_format = VK_FORMAT_UNDEFINED;
 };
 
 } // namespace zephyr
@@ -143,11 +143,12 @@ void VulkanSwapChain::create_image_views(VkDevice logical_device_handle,
 
 void VulkanSwapChain::create_framebuffers(VulkanLogicalDevice logical_device,
                                           VulkanSwapChain &swap_chain,
-                                          VulkanRenderPass render_pass) {
+                                          VulkanRenderPass render_pass,
+                                          VkImageView depth_view) {
   swap_chain.framebuffers.resize(swap_chain.image_views.size());
 
   for (size_t i = 0; i < swap_chain.framebuffers.size(); i++) {
-    VkImageView attachments[] = {swap_chain.image_views[i]};
+    VkImageView attachments[] = {swap_chain.image_views[i], depth_view};
 
     VkFramebufferCreateInfo framebuffer_info{};
     framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -155,7 +156,7 @@ void VulkanSwapChain::create_framebuffers(VulkanLogicalDevice logical_device,
     framebuffer_info.height = swap_chain.extent.height;
     framebuffer_info.renderPass = render_pass.handle;
     framebuffer_info.pAttachments = attachments;
-    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.attachmentCount = 2;
     framebuffer_info.layers = 1;
 
     ZEPH_ENSURE(vkCreateFramebuffer(logical_device.handle, &framebuffer_info,
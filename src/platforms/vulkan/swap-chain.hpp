@@ -97,7 +97,8 @@ public:
 
   static void create_framebuffers(VulkanLogicalDevice logical_device,
                                   VulkanSwapChain &swap_chain,
-                                  VulkanRenderPass render_pass);
+                                  VulkanRenderPass render_pass,
+                                  VkImageView depth_view);
 
   void cleanup();
 };
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "log.hpp"
+#include "platforms/vulkan/descriptor-allocator.hpp"
+#include "platforms/vulkan/descriptor-set.hpp"
+#include "platforms/vulkan/device.hpp"
+#include <algorithm>
+#include <vulkan/vulkan_core.h>
+
+namespace zephyr {
+
+// Every texture the renderer knows, in one descriptor set that all draws
+// share as set 1. Shaders index it with the material index of the object
+// they draw, so switching textures never switches descriptors. The array is
+// partially bound and update-after-bind: new textures can be added while
+// earlier frames using the set are still in flight, as long as those frames
+// don't read the new slot.
+//
+// This lives apart from the per-frame set because update-after-bind layouts
+// can't hold dynamic buffers.
+class VulkanTextureTable {
+public:
+  static constexpr uint32_t MAX_TEXTURES = 4096;
+
+  void init(VulkanLogicalDevice logical_device,
+            const VulkanPhysicalDevice &physical_device,
+            VulkanDescriptorLayoutCache &layouts) {
+    m_logical_device = logical_device;
+
+    const auto &limits = physical_device.descriptor_indexing_properties;
+    m_capacity = std::min<uint32_t>(
+        {MAX_TEXTURES, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+         limits.maxDescriptorSetUpdateAfterBindSamplers,
+         limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+         limits.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = m_capacity;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlags binding_flags =
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+
+    m_set_layout = layouts.get(
+        {&binding, 1},
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        {&binding_flags, 1});
+
+    VkDescriptorPoolSize pool_size{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                   m_capacity};
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    pool_info.maxSets = 1;
+
+    ZEPH_ENSURE(vkCreateDescriptorPool(logical_device.handle, &pool_info,
+                                       nullptr, &m_pool) != VK_SUCCESS,
+                "Couldn't create texture table pool");
+
+    VkDescriptorSetAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = m_pool;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &m_set_layout.handle();
+
+    ZEPH_ENSURE(vkAllocateDescriptorSets(logical_device.handle, &allocate_info,
+                                         &m_set) != VK_SUCCESS,
+                "Couldn't allocate texture table");
+
+    LOG_INFO("Texture table holds up to", m_capacity, "textures");
+  }
+
+  // Returns the index shaders use to sample the texture.
+  uint32_t add(VkImageView image_view, VkSampler sampler) {
+    ZEPH_ENSURE(m_count >= m_capacity, "Texture table is full: ", m_capacity);
+
+    write(m_count, image_view, sampler);
+
+    REPORT_METRIC("renderer", "textures", m_count + 1);
+    return m_count++;
+  }
+
+  // Points an existing index at another texture. The old one must not be
+  // read by any frame still in flight.
+  void write(uint32_t index, VkImageView image_view, VkSampler sampler) {
+    VkDescriptorImageInfo image_info{};
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    image_info.imageView = image_view;
+    image_info.sampler = sampler;
+
+    VkWriteDescriptorSet descriptor_write{};
+    descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptor_write.dstSet = m_set;
+    descriptor_write.dstBinding = 0;
+    descriptor_write.dstArrayElement = index;
+    descriptor_write.descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptor_write.descriptorCount = 1;
+    descriptor_write.pImageInfo = &image_info;
+
+    vkUpdateDescriptorSets(m_logical_device.handle, 1, &descriptor_write, 0,
+                           nullptr);
+  }
+
+  VulkanDescriptorSetLayout &layout() { return m_set_layout; }
+  const VkDescriptorSet &set() const { return m_set; }
+  uint32_t size() const { return m_count; }
+  uint32_t capacity() const { return m_capacity; }
+
+  // The layout belongs to the layout cache.
+  void cleanup() {
+    vkDestroyDescriptorPool(m_logical_device.handle, m_pool, nullptr);
+  }
+
+private:
+  VulkanLogicalDevice m_logical_device;
+  VulkanDescriptorSetLayout m_set_layout;
+  VkDescriptorPool m_pool = VK_NULL_HANDLE;
+  VkDescriptorSet m_set = VK_NULL_HANDLE;
+  uint32_t m_capacity = 0;
+  uint32_t m_count = 0;
+};
+
+} // namespace zephyr
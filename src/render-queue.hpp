@@ -0,0 +1,156 @@
+#pragma once
+
+#include "log.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace zephyr {
+
+// Packs the state a draw needs into one integer so that sorting by it groups
+// draws by whatever is most expensive to switch. From the most significant
+// bit: pass (8), pipeline (24), depth (32). Fields wider than their slot are
+// clamped, which only costs sort quality.
+//
+// There is no material or mesh field: textures are indexed per object from
+// the bindless table and every mesh lives in the registry's shared buffers,
+// so neither changes bound state between draws.
+struct RenderKey {
+  static constexpr uint32_t PASS_BITS = 8;
+  static constexpr uint32_t PIPELINE_BITS = 24;
+  static constexpr uint32_t DEPTH_BITS = 32;
+
+  static constexpr uint32_t DEPTH_SHIFT = 0;
+  static constexpr uint32_t PIPELINE_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+  static constexpr uint32_t PASS_SHIFT = PIPELINE_SHIFT + PIPELINE_BITS;
+
+  static constexpr uint32_t DEPTH_MAX =
+      static_cast<uint32_t>((uint64_t{1} << DEPTH_BITS) - 1);
+
+  static_assert(PASS_SHIFT + PASS_BITS == 64);
+
+  static constexpr uint64_t make(uint32_t pass, uint32_t pipeline,
+                                 uint32_t depth) {
+    return pack(pass, PASS_BITS, PASS_SHIFT) |
+           pack(pipeline, PIPELINE_BITS, PIPELINE_SHIFT) |
+           pack(depth, DEPTH_BITS, DEPTH_SHIFT);
+  }
+
+  static constexpr uint32_t pass(uint64_t key) {
+    return unpack(key, PASS_BITS, PASS_SHIFT);
+  }
+  static constexpr uint32_t pipeline(uint64_t key) {
+    return unpack(key, PIPELINE_BITS, PIPELINE_SHIFT);
+  }
+  static constexpr uint32_t depth(uint64_t key) {
+    return unpack(key, DEPTH_BITS, DEPTH_SHIFT);
+  }
+
+  // Bit patterns of non-negative floats order like the floats themselves,
+  // so any distance sorts without a fixed range.
+  static constexpr uint32_t depth_bits(float distance) {
+    return std::bit_cast<uint32_t>(std::max(distance, 0.0f));
+  }
+
+private:
+  static constexpr uint64_t mask(uint32_t bits) {
+    return (uint64_t{1} << bits) - 1;
+  }
+
+  static constexpr uint64_t pack(uint32_t value, uint32_t bits,
+                                 uint32_t shift) {
+    return std::min<uint64_t>(value, mask(bits)) << shift;
+  }
+
+  static constexpr uint32_t unpack(uint64_t key, uint32_t bits,
+                                   uint32_t shift) {
+    return static_cast<uint32_t>((key >> shift) & mask(bits));
+  }
+};
+
+// `draw` indexes whatever the submitter keeps per draw; the queue only
+// orders it.
+struct RenderItem {
+  uint64_t key;
+  uint32_t draw;
+};
+
+// Counts what a submitter actually recorded after redundant binds were
+// skipped.
+struct RenderQueueStats {
+  size_t pipeline_binds = 0;
+  size_t descriptor_binds = 0;
+  size_t vertex_buffer_binds = 0;
+  size_t draw_calls = 0;
+  size_t skipped_draws = 0;
+
+  RenderQueueStats &operator+=(const RenderQueueStats &other) {
+    pipeline_binds += other.pipeline_binds;
+    descriptor_binds += other.descriptor_binds;
+    vertex_buffer_binds += other.vertex_buffer_binds;
+    draw_calls += other.draw_calls;
+    skipped_draws += other.skipped_draws;
+    return *this;
+  }
+};
+
+// Per-frame list of draws, sorted by key with an LSD radix sort. Byte
+// positions where every key agrees are skipped, so a queue that only varies
+// in a few fields sorts in a few passes. Storage is reused across frames.
+class RenderQueue {
+public:
+  void clear() { m_items.clear(); }
+
+  void push(uint64_t key, uint32_t draw) { m_items.push_back({key, draw}); }
+
+  void sort() {
+    constexpr uint32_t DIGITS = sizeof(uint64_t);
+    constexpr uint32_t RADIX = 256;
+
+    size_t count = m_items.size();
+    if (count < 2)
+      return;
+
+    std::array<std::array<uint32_t, RADIX>, DIGITS> histograms{};
+
+    for (auto &item : m_items) {
+      for (uint32_t digit = 0; digit < DIGITS; digit++)
+        histograms[digit][(item.key >> (digit * 8)) & 0xff]++;
+    }
+
+    m_scratch.resize(count);
+
+    for (uint32_t digit = 0; digit < DIGITS; digit++) {
+      auto &histogram = histograms[digit];
+      uint32_t first_byte = (m_items[0].key >> (digit * 8)) & 0xff;
+
+      if (histogram[first_byte] == count)
+        continue;
+
+      uint32_t offset = 0;
+      for (auto &bucket : histogram) {
+        uint32_t size = bucket;
+        bucket = offset;
+        offset += size;
+      }
+
+      for (auto &item : m_items)
+        m_scratch[histogram[(item.key >> (digit * 8)) & 0xff]++] = item;
+
+      m_items.swap(m_scratch);
+    }
+
+    REPORT_METRIC("renderer", "render_queue_items", count);
+  }
+
+  const std::vector<RenderItem> &items() const { return m_items; }
+  size_t size() const { return m_items.size(); }
+
+private:
+  std::vector<RenderItem> m_items;
+  std::vector<RenderItem> m_scratch;
+};
+
+} // namespace zephyr
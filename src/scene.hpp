@@ -0,0 +1,602 @@
+#pragma once
+
+#include "assert.hpp"
+#include "components.hpp"
+#include "entity.hpp"
+#include "log.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace zephyr {
+
+// On-disk layout, native endianness:
+//
+//   SceneHeader
+//   SceneArchetypeHeader[archetype_count]
+//   SceneColumnHeader[sum of column_count]
+//   SceneAssetHeader[asset_count]
+//   entity id, column and asset name blocks, each aligned to
+//   SCENE_BLOCK_ALIGNMENT
+//
+// Column blocks are the archetype's Column::data verbatim, so loading is one
+// memcpy per column rather than per entity. The exceptions are fields that
+// only mean something in the running process: a MeshComponent row holds its
+// asset index as a uint32_t followed by zeros, MaterialComponent::texture
+// holds an asset index, and RenderSlotComponent rows are zeroed.
+const constexpr uint32_t SCENE_MAGIC = 0x4e43535a; // "ZSCN"
+const constexpr uint32_t SCENE_VERSION = 2;
+const constexpr uint64_t SCENE_BLOCK_ALIGNMENT = 64;
+
+struct SceneHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t archetype_count;
+  uint32_t next_id;
+  uint64_t entity_count;
+  uint64_t file_size;
+  uint32_t asset_count;
+  uint32_t reserved;
+  uint64_t asset_table_offset;
+};
+
+struct SceneArchetypeHeader {
+  uint32_t column_count;
+  uint32_t row_count;
+  uint64_t first_column;
+  uint64_t entity_ids_offset;
+};
+
+struct SceneColumnHeader {
+  uint64_t stable_id;
+  uint32_t stride;
+  uint32_t alignment;
+  uint64_t data_offset;
+};
+
+enum class SceneAssetKind : uint32_t { MESH, TEXTURE };
+
+struct SceneAssetHeader {
+  uint32_t kind;
+  uint32_t name_size;
+  uint64_t name_offset;
+};
+
+static_assert(std::is_trivially_copyable_v<SceneHeader> &&
+              std::is_trivially_copyable_v<SceneArchetypeHeader> &&
+              std::is_trivially_copyable_v<SceneColumnHeader> &&
+              std::is_trivially_copyable_v<SceneAssetHeader>);
+
+// Names for the assets entities reference. Mesh handles and texture indices
+// depend on registration order, so files store these names and loading maps
+// them back to whatever the current process registered under them.
+struct SceneAssets {
+  std::unordered_map<std::string, MeshHandle> meshes;
+  std::unordered_map<std::string, uint32_t> textures;
+};
+
+class SceneFile {
+public:
+  // Stable ids are only resolvable for components the process has seen, so
+  // the engine's own components are registered up front.
+  static void register_builtin_components() {
+    component_type_id<TransformComponent>();
+    component_type_id<CameraComponent>();
+    component_type_id<MeshComponent>();
+    component_type_id<MaterialComponent>();
+    component_type_id<CameraTagComponent>();
+    component_type_id<ObjectTagComponent>();
+    component_type_id<OccluderTagComponent>();
+    component_type_id<RenderSlotComponent>();
+  }
+
+  static void save(World &world, const std::string &path,
+                   const SceneAssets &assets) {
+    std::vector<const ArchetypeStorage *> stored;
+    uint64_t column_total = 0;
+    uint64_t entity_count = 0;
+
+    for (auto &[sig, arch] : world.archetypes) {
+      if (arch.entity_ids.empty())
+        continue;
+
+      for (auto &[ct, col] : arch.columns) {
+        ZEPH_ENSURE(!component_info(ct).trivially_copyable,
+                    "Component ", ct,
+                    " is not trivially copyable and can't be stored verbatim");
+      }
+
+      stored.push_back(&arch);
+      column_total += arch.columns.size();
+      entity_count += arch.entity_ids.size();
+    }
+
+    AssetNames names(assets);
+
+    // Columns holding runtime handles are written from a rewritten copy.
+    std::vector<std::vector<std::byte>> rewritten;
+    rewritten.reserve(column_total);
+
+    auto column_bytes = [&](ComponentTypeId ct, const Column &col) {
+      if (!holds_handles(ct))
+        return std::span<const std::byte>(col.data);
+
+      auto &copy = rewritten.emplace_back(col.data);
+      for (size_t row = 0; row < col.count(); row++)
+        persist_row(ct, copy.data() + row * col.stride, names);
+      return std::span<const std::byte>(copy);
+    };
+
+    std::vector<std::vector<std::span<const std::byte>>> column_data;
+    for (auto *arch : stored) {
+      auto &spans = column_data.emplace_back();
+      for (auto &[ct, col] : arch->columns)
+        spans.push_back(column_bytes(ct, col));
+    }
+
+    std::vector<SceneArchetypeHeader> archetype_headers;
+    std::vector<SceneColumnHeader> column_headers;
+    std::vector<SceneAssetHeader> asset_headers(names.entries.size());
+    std::vector<std::pair<const std::byte *, uint64_t>> blocks;
+
+    uint64_t asset_table_offset =
+        sizeof(SceneHeader) + stored.size() * sizeof(SceneArchetypeHeader) +
+        column_total * sizeof(SceneColumnHeader);
+    uint64_t offset =
+        asset_table_offset + asset_headers.size() * sizeof(SceneAssetHeader);
+
+    auto place_block = [&](const void *data, uint64_t size) {
+      offset = align(offset);
+      uint64_t block_offset = offset;
+      blocks.emplace_back(static_cast<const std::byte *>(data), size);
+      offset += size;
+      return block_offset;
+    };
+
+    for (size_t a = 0; a < stored.size(); a++) {
+      const ArchetypeStorage *arch = stored[a];
+
+      SceneArchetypeHeader arch_header{};
+      arch_header.column_count = static_cast<uint32_t>(arch->columns.size());
+      arch_header.row_count = static_cast<uint32_t>(arch->entity_ids.size());
+      arch_header.first_column = column_headers.size();
+      arch_header.entity_ids_offset =
+          place_block(arch->entity_ids.data(),
+                      arch->entity_ids.size() * sizeof(EntityId));
+
+      size_t c = 0;
+      for (auto &[ct, col] : arch->columns) {
+        const ComponentInfo &info = component_info(ct);
+        std::span<const std::byte> data = column_data[a][c++];
+
+        SceneColumnHeader col_header{};
+        col_header.stable_id = info.stable_id;
+        col_header.stride = static_cast<uint32_t>(col.stride);
+        col_header.alignment = static_cast<uint32_t>(info.alignment);
+        col_header.data_offset = place_block(data.data(), data.size());
+
+        column_headers.push_back(col_header);
+      }
+
+      archetype_headers.push_back(arch_header);
+    }
+
+    for (size_t i = 0; i < names.entries.size(); i++) {
+      const auto &[kind, name] = names.entries[i];
+      asset_headers[i].kind = static_cast<uint32_t>(kind);
+      asset_headers[i].name_size = static_cast<uint32_t>(name.size());
+      asset_headers[i].name_offset = place_block(name.data(), name.size());
+    }
+
+    SceneHeader header{};
+    header.magic = SCENE_MAGIC;
+    header.version = SCENE_VERSION;
+    header.archetype_count = static_cast<uint32_t>(archetype_headers.size());
+    header.next_id = world.m_next_id;
+    header.entity_count = entity_count;
+    header.file_size = offset;
+    header.asset_count = static_cast<uint32_t>(asset_headers.size());
+    header.asset_table_offset = asset_table_offset;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    ZEPH_ENSURE(!file.is_open(), "Couldn't open scene file for writing: ",
+                path);
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(archetype_headers.data()),
+               archetype_headers.size() * sizeof(SceneArchetypeHeader));
+    file.write(reinterpret_cast<const char *>(column_headers.data()),
+               column_headers.size() * sizeof(SceneColumnHeader));
+    file.write(reinterpret_cast<const char *>(asset_headers.data()),
+               asset_headers.size() * sizeof(SceneAssetHeader));
+
+    uint64_t written = asset_table_offset +
+                       asset_headers.size() * sizeof(SceneAssetHeader);
+
+    static const char padding[SCENE_BLOCK_ALIGNMENT] = {};
+
+    for (auto &[data, size] : blocks) {
+      uint64_t aligned = align(written);
+      file.write(padding, aligned - written);
+      file.write(reinterpret_cast<const char *>(data), size);
+      written = aligned + size;
+    }
+
+    ZEPH_ENSURE(!file.good(), "Couldn't write scene file: ", path);
+  }
+
+  // Maps the file and appends each stored column block to the matching
+  // archetype in one copy. The world must not hold any entity yet. The whole
+  // file is validated before the world is touched, so a bad file leaves it
+  // empty.
+  static void load(World &world, const std::string &path,
+                   const SceneAssets &assets) {
+    ZEPH_ENSURE(!world.entity_records.empty(),
+                "Scenes can only be loaded into an empty world");
+
+    register_builtin_components();
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    ZEPH_ENSURE(fd < 0, "Couldn't open scene file: ", path);
+
+    struct stat file_stat{};
+    int stat_result = fstat(fd, &file_stat);
+    size_t file_size =
+        stat_result == 0 ? static_cast<size_t>(file_stat.st_size) : 0;
+
+    void *mapped = MAP_FAILED;
+    if (file_size >= sizeof(SceneHeader))
+      mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    ZEPH_ENSURE(stat_result != 0, "Couldn't stat scene file: ", path);
+    ZEPH_ENSURE(file_size < sizeof(SceneHeader), "Scene file is truncated: ",
+                path);
+    ZEPH_ENSURE(mapped == MAP_FAILED, "Couldn't map scene file: ", path);
+
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+    madvise(mapped, file_size, MADV_WILLNEED);
+
+    const auto *base = static_cast<const std::byte *>(mapped);
+
+    try {
+      adopt(world, base, file_size, assets);
+    } catch (...) {
+      munmap(mapped, file_size);
+      throw;
+    }
+
+    munmap(mapped, file_size);
+  }
+
+private:
+  // Assigns each referenced asset a table index while saving.
+  struct AssetNames {
+    std::vector<std::pair<SceneAssetKind, std::string>> entries;
+    std::unordered_map<uint64_t, std::string> mesh_names;
+    std::unordered_map<uint32_t, std::string> texture_names;
+    std::unordered_map<std::string, uint32_t> mesh_refs;
+    std::unordered_map<std::string, uint32_t> texture_refs;
+
+    explicit AssetNames(const SceneAssets &assets) {
+      for (auto &[name, mesh] : assets.meshes)
+        mesh_names.emplace(mesh_key(mesh), name);
+      for (auto &[name, texture] : assets.textures)
+        texture_names.emplace(texture, name);
+    }
+
+    uint32_t mesh(MeshHandle mesh) {
+      auto it = mesh_names.find(mesh_key(mesh));
+
+      ZEPH_ENSURE(it == mesh_names.end(), "Mesh at index ", mesh.first_index,
+                  " has no scene asset name");
+
+      return ref(SceneAssetKind::MESH, it->second, mesh_refs);
+    }
+
+    uint32_t texture(uint32_t texture) {
+      auto it = texture_names.find(texture);
+
+      ZEPH_ENSURE(it == texture_names.end(), "Texture ", texture,
+                  " has no scene asset name");
+
+      return ref(SceneAssetKind::TEXTURE, it->second, texture_refs);
+    }
+
+    uint32_t ref(SceneAssetKind kind, const std::string &name,
+                 std::unordered_map<std::string, uint32_t> &refs) {
+      auto [it, added] =
+          refs.emplace(name, static_cast<uint32_t>(entries.size()));
+      if (added)
+        entries.emplace_back(kind, name);
+      return it->second;
+    }
+  };
+
+  // Current handles for the file's asset table, by index.
+  struct ResolvedAssets {
+    std::vector<SceneAssetKind> kinds;
+    std::vector<MeshHandle> meshes;
+    std::vector<uint32_t> textures;
+  };
+
+  struct PendingColumn {
+    ComponentTypeId id;
+    uint32_t stride;
+    const std::byte *data;
+    uint64_t size;
+  };
+
+  struct PendingArchetype {
+    ArchetypeSignature signature;
+    const EntityId *entity_ids;
+    size_t rows;
+    std::vector<PendingColumn> columns;
+  };
+
+  static uint64_t align(uint64_t offset) {
+    return (offset + SCENE_BLOCK_ALIGNMENT - 1) & ~(SCENE_BLOCK_ALIGNMENT - 1);
+  }
+
+  static uint64_t mesh_key(MeshHandle mesh) {
+    return (static_cast<uint64_t>(mesh.first_index) << 32) |
+           static_cast<uint32_t>(mesh.vertex_offset);
+  }
+
+  static bool holds_handles(ComponentTypeId ct) {
+    return ct == component_type_id<MeshComponent>() ||
+           ct == component_type_id<MaterialComponent>() ||
+           ct == component_type_id<RenderSlotComponent>();
+  }
+
+  static void persist_row(ComponentTypeId ct, std::byte *row,
+                          AssetNames &names) {
+    if (ct == component_type_id<MeshComponent>()) {
+      auto *mesh = reinterpret_cast<MeshComponent *>(row);
+      uint32_t ref = names.mesh(mesh->mesh);
+      std::memset(row, 0, sizeof(MeshComponent));
+      std::memcpy(row, &ref, sizeof(ref));
+    } else if (ct == component_type_id<MaterialComponent>()) {
+      auto *material = reinterpret_cast<MaterialComponent *>(row);
+      material->texture = names.texture(material->texture);
+    } else if (ct == component_type_id<RenderSlotComponent>()) {
+      std::memset(row, 0, sizeof(RenderSlotComponent));
+    }
+  }
+
+  // Reads the asset index a saved row holds, or nothing for components
+  // without one.
+  static std::optional<std::pair<SceneAssetKind, uint32_t>>
+  row_ref(ComponentTypeId ct, const std::byte *row) {
+    uint32_t ref = 0;
+
+    if (ct == component_type_id<MeshComponent>()) {
+      std::memcpy(&ref, row, sizeof(ref));
+      return std::pair{SceneAssetKind::MESH, ref};
+    }
+    if (ct == component_type_id<MaterialComponent>()) {
+      std::memcpy(&ref, row + offsetof(MaterialComponent, texture),
+                  sizeof(ref));
+      return std::pair{SceneAssetKind::TEXTURE, ref};
+    }
+
+    return std::nullopt;
+  }
+
+  static void resolve_row(ComponentTypeId ct, std::byte *row,
+                          const ResolvedAssets &resolved) {
+    auto ref = row_ref(ct, row);
+    if (!ref.has_value())
+      return;
+
+    if (ref->first == SceneAssetKind::MESH) {
+      MeshComponent mesh{};
+      mesh.mesh = resolved.meshes[ref->second];
+      std::memcpy(row, &mesh, sizeof(mesh));
+    } else {
+      reinterpret_cast<MaterialComponent *>(row)->texture =
+          resolved.textures[ref->second];
+    }
+  }
+
+  static void adopt(World &world, const std::byte *base, size_t file_size,
+                    const SceneAssets &assets) {
+    SceneHeader header;
+    std::memcpy(&header, base, sizeof(header));
+
+    ZEPH_ENSURE(header.magic != SCENE_MAGIC, "Not a zephyr scene file");
+    ZEPH_ENSURE(header.version != SCENE_VERSION, "Unsupported scene version ",
+                header.version, ", expected ", SCENE_VERSION);
+    ZEPH_ENSURE(header.file_size != file_size, "Scene file size mismatch");
+
+    auto in_bounds = [&](uint64_t offset, uint64_t size) {
+      return offset <= file_size && size <= file_size - offset;
+    };
+
+    // First pass: check every table, block and asset reference, so nothing
+    // below can fail halfway through filling the world.
+    uint64_t column_table_offset =
+        sizeof(header) + header.archetype_count * sizeof(SceneArchetypeHeader);
+
+    ZEPH_ENSURE(!in_bounds(sizeof(header), column_table_offset - sizeof(header)),
+                "Scene archetype table is out of bounds");
+    ZEPH_ENSURE(!in_bounds(header.asset_table_offset,
+                           header.asset_count * sizeof(SceneAssetHeader)),
+                "Scene asset table is out of bounds");
+
+    const auto *archetype_headers =
+        reinterpret_cast<const SceneArchetypeHeader *>(base + sizeof(header));
+    const auto *asset_headers = reinterpret_cast<const SceneAssetHeader *>(
+        base + header.asset_table_offset);
+
+    ResolvedAssets resolved = resolve_assets(base, asset_headers,
+                                             header.asset_count, assets,
+                                             in_bounds);
+
+    std::vector<PendingArchetype> pending(header.archetype_count);
+    std::unordered_set<EntityId> seen_ids;
+    seen_ids.reserve(header.entity_count);
+
+    for (uint32_t a = 0; a < header.archetype_count; a++) {
+      const SceneArchetypeHeader &arch_header = archetype_headers[a];
+      PendingArchetype &arch = pending[a];
+      uint64_t columns_offset =
+          column_table_offset +
+          arch_header.first_column * sizeof(SceneColumnHeader);
+
+      ZEPH_ENSURE(!in_bounds(columns_offset, arch_header.column_count *
+                                                 sizeof(SceneColumnHeader)),
+                  "Scene column table is out of bounds");
+
+      const auto *columns =
+          reinterpret_cast<const SceneColumnHeader *>(base + columns_offset);
+
+      arch.rows = arch_header.row_count;
+
+      ZEPH_ENSURE(!in_bounds(arch_header.entity_ids_offset,
+                             arch.rows * sizeof(EntityId)),
+                  "Scene entity block is out of bounds");
+
+      arch.entity_ids = reinterpret_cast<const EntityId *>(
+          base + arch_header.entity_ids_offset);
+
+      for (size_t row = 0; row < arch.rows; row++) {
+        ZEPH_ENSURE(!seen_ids.insert(arch.entity_ids[row]).second,
+                    "Scene stores entity ", arch.entity_ids[row], " twice");
+      }
+
+      for (uint32_t c = 0; c < arch_header.column_count; c++) {
+        auto id = find_component(columns[c].stable_id);
+
+        ZEPH_ENSURE(!id.has_value(), "Scene references unregistered component ",
+                    columns[c].stable_id);
+        ZEPH_ENSURE(component_info(*id).size != columns[c].stride ||
+                        component_info(*id).alignment != columns[c].alignment,
+                    "Component ", *id, " layout changed since scene was saved");
+        ZEPH_ENSURE(arch.signature.test(*id),
+                    "Scene archetype lists component ", *id, " twice");
+
+        uint64_t size = arch.rows * columns[c].stride;
+
+        ZEPH_ENSURE(!in_bounds(columns[c].data_offset, size),
+                    "Scene column block is out of bounds");
+
+        const std::byte *data = base + columns[c].data_offset;
+        for (size_t row = 0; row < arch.rows; row++) {
+          auto ref = row_ref(*id, data + row * columns[c].stride);
+          if (!ref.has_value())
+            break;
+
+          ZEPH_ENSURE(ref->second >= resolved.kinds.size() ||
+                          resolved.kinds[ref->second] != ref->first,
+                      "Scene row references invalid asset ", ref->second);
+        }
+
+        arch.signature.set(*id);
+        arch.columns.push_back({*id, columns[c].stride, data, size});
+      }
+    }
+
+    ZEPH_ENSURE(seen_ids.size() != header.entity_count,
+                "Scene entity count mismatch");
+
+    // Second pass: everything is known to be valid, so only copy.
+    world.entity_records.reserve(header.entity_count);
+
+    for (auto &pending_arch : pending) {
+      ArchetypeStorage &arch = world.archetypes[pending_arch.signature];
+      arch.signature = pending_arch.signature;
+
+      size_t first_row = arch.entity_ids.size();
+      arch.entity_ids.insert(arch.entity_ids.end(), pending_arch.entity_ids,
+                             pending_arch.entity_ids + pending_arch.rows);
+
+      for (auto &pending_col : pending_arch.columns) {
+        Column &col = arch.columns[pending_col.id];
+        col.stride = pending_col.stride;
+
+        size_t first_byte = col.data.size();
+        col.data.insert(col.data.end(), pending_col.data,
+                        pending_col.data + pending_col.size);
+
+        if (holds_handles(pending_col.id)) {
+          for (size_t offset = first_byte; offset < col.data.size();
+               offset += col.stride)
+            resolve_row(pending_col.id, col.data.data() + offset, resolved);
+        }
+
+        col.touch_all(world.m_change_tick);
+      }
+
+      for (size_t row = first_row; row < arch.entity_ids.size(); row++)
+        world.entity_records[arch.entity_ids[row]] = {&arch, row};
+
+      world.assign_render_slots(arch, first_row);
+    }
+
+    world.m_next_id = std::max(world.m_next_id, header.next_id);
+
+    LOG_INFO("Loaded scene with", header.entity_count, "entities in",
+             header.archetype_count, "archetypes");
+  }
+
+  template <typename InBounds>
+  static ResolvedAssets resolve_assets(const std::byte *base,
+                                       const SceneAssetHeader *headers,
+                                       uint32_t count,
+                                       const SceneAssets &assets,
+                                       InBounds &&in_bounds) {
+    ResolvedAssets resolved;
+    resolved.kinds.resize(count);
+    resolved.meshes.resize(count);
+    resolved.textures.resize(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+      ZEPH_ENSURE(!in_bounds(headers[i].name_offset, headers[i].name_size),
+                  "Scene asset name is out of bounds");
+
+      std::string name(reinterpret_cast<const char *>(base) +
+                           headers[i].name_offset,
+                       headers[i].name_size);
+
+      switch (static_cast<SceneAssetKind>(headers[i].kind)) {
+      case SceneAssetKind::MESH: {
+        auto it = assets.meshes.find(name);
+        ZEPH_ENSURE(it == assets.meshes.end(), "Scene references unknown mesh ",
+                    name);
+        resolved.kinds[i] = SceneAssetKind::MESH;
+        resolved.meshes[i] = it->second;
+        break;
+      }
+      case SceneAssetKind::TEXTURE: {
+        auto it = assets.textures.find(name);
+        ZEPH_ENSURE(it == assets.textures.end(),
+                    "Scene references unknown texture ", name);
+        resolved.kinds[i] = SceneAssetKind::TEXTURE;
+        resolved.textures[i] = it->second;
+        break;
+      }
+      default:
+        ZEPH_EXCEPTION("Scene asset ", i, " has unknown kind ",
+                       headers[i].kind);
+      }
+    }
+
+    return resolved;
+  }
+};
+
+} // namespace zephyr
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "base.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace zephyr {
+
+// Column bytes are captured in fixed-size chunks so unchanged chunks can be
+// shared between consecutive snapshots instead of copied again.
+const constexpr size_t SNAPSHOT_CHUNK_BYTES = 16 * 1024;
+
+using SnapshotChunk = Ref<std::vector<std::byte>>;
+
+struct ColumnSnapshot {
+  ComponentTypeId component = 0;
+  size_t stride = 0;
+  size_t size = 0;
+  std::vector<SnapshotChunk> chunks;
+};
+
+struct ArchetypeSnapshot {
+  ArchetypeSignature signature;
+  std::vector<EntityId> entity_ids;
+  std::vector<ColumnSnapshot> columns;
+
+  const ColumnSnapshot *find(ComponentTypeId component) const {
+    for (auto &column : columns)
+      if (column.component == component)
+        return &column;
+    return nullptr;
+  }
+};
+
+struct WorldSnapshot {
+  uint32_t tick = 0;
+  EntityId next_id = 0;
+
+  // Entries past archetype_count are stale and kept only for their capacity.
+  size_t archetype_count = 0;
+  std::vector<ArchetypeSnapshot> archetypes;
+
+  // Archetypes usually come back in the same order frame to frame, so the
+  // caller's index is tried before falling back to a linear scan.
+  const ArchetypeSnapshot *find(ArchetypeSignature signature,
+                                size_t hint) const {
+    if (hint < archetype_count && archetypes[hint].signature == signature)
+      return &archetypes[hint];
+
+    for (size_t i = 0; i < archetype_count; i++)
+      if (archetypes[i].signature == signature)
+        return &archetypes[i];
+
+    return nullptr;
+  }
+};
+
+struct SnapshotStats {
+  size_t bytes_copied = 0;
+  size_t chunks_copied = 0;
+  size_t chunks_shared = 0;
+};
+
+class SnapshotRing {
+public:
+  void reserve(size_t capacity) {
+    m_slots.clear();
+    m_slots.resize(capacity);
+    m_head = 0;
+    m_count = 0;
+  }
+
+  size_t capacity() const { return m_slots.size(); }
+  size_t size() const { return m_count; }
+
+  // Hands out the oldest slot for overwriting and makes it the latest one.
+  WorldSnapshot &acquire() {
+    WorldSnapshot &slot = m_slots[m_head];
+    m_head = (m_head + 1) % m_slots.size();
+    m_count = std::min(m_count + 1, m_slots.size());
+    return slot;
+  }
+
+  WorldSnapshot *at(size_t frames_back) {
+    if (frames_back >= m_count)
+      return nullptr;
+
+    size_t index =
+        (m_head + m_slots.size() - 1 - frames_back) % m_slots.size();
+    return &m_slots[index];
+  }
+
+  const WorldSnapshot *at(size_t frames_back) const {
+    return const_cast<SnapshotRing *>(this)->at(frames_back);
+  }
+
+  WorldSnapshot *latest() { return at(0); }
+
+  // Forgets the snapshots taken after the one `frames_back` steps behind, so
+  // simulation resumes from it as the newest entry.
+  void drop_newer(size_t frames_back) {
+    if (frames_back >= m_count)
+      return;
+
+    m_head = (m_head + m_slots.size() - frames_back) % m_slots.size();
+    m_count -= frames_back;
+  }
+
+private:
+  std::vector<WorldSnapshot> m_slots;
+  size_t m_head = 0;
+  size_t m_count = 0;
+};
+
+} // namespace zephyr
@@ -6,18 +6,16 @@
 
 namespace zephyr {
 
-struct EntityUniformBuffer {
-  alignas(16) glm::mat4 model;
+// Camera and time data shared by every draw of a frame, bound once.
+struct GlobalUniformBuffer {
   alignas(16) glm::mat4 view;
   alignas(16) glm::mat4 projection;
   alignas(16) float time;
   alignas(16) glm::vec3 view_position;
   alignas(16) glm::vec3 camera_forward;
 
-  void update(const TransformComponent &transform,
-              const CameraComponent &camera,
+  void update(const CameraComponent &camera,
               const TransformComponent &camera_transform) {
-    model = transform.matrix;
     view = camera.view_matrix;
     projection = camera.projection_matrix;
 
@@ -34,35 +32,53 @@ struct EntityUniformBuffer {
   }
 };
 
+// First three rows of the model matrix. The bottom row of an affine transform
+// is always (0, 0, 0, 1), so the shader rebuilds it instead of reading it.
+// `texture` indexes the renderer's texture table.
+struct ObjectUniformBuffer {
+  glm::vec4 model_rows[3];
+  uint32_t texture;
+  uint32_t padding[3];
+
+  void update(const TransformComponent &transform, uint32_t texture_index) {
+    glm::mat4 rows = glm::transpose(transform.matrix);
+
+    model_rows[0] = rows[0];
+    model_rows[1] = rows[1];
+    model_rows[2] = rows[2];
+    texture = texture_index;
+  }
+};
+
+static_assert(sizeof(ObjectUniformBuffer) == 64,
+              "ObjectUniformBuffer must match the std430 ObjectData layout");
+
+// Dense per-object data indexed by RenderSlotComponent::slot. Entities own
+// their slot, so no lookup by id is needed.
 struct UniformTable {
-  std::vector<EntityUniformBuffer> slots;
-  std::unordered_map<EntityId, size_t> index;
-  std::vector<size_t> free_slots;
+  GlobalUniformBuffer global;
+  std::vector<ObjectUniformBuffer> slots;
+  std::vector<uint32_t> free_slots;
 
-  void allocate(EntityId id) {
-    size_t slot;
+  uint32_t allocate() {
     if (!free_slots.empty()) {
-      slot = free_slots.back();
+      uint32_t slot = free_slots.back();
       free_slots.pop_back();
       slots[slot] = {};
-    } else {
-      slot = slots.size();
-      slots.emplace_back();
+      return slot;
     }
-    index[id] = slot;
-  }
 
-  void free(EntityId id) {
-    auto it = index.find(id);
-    if (it == index.end())
-      return;
-    free_slots.push_back(it->second);
-    index.erase(it);
+    slots.emplace_back();
+    return static_cast<uint32_t>(slots.size() - 1);
   }
 
-  EntityUniformBuffer *get(EntityId id) {
-    auto it = index.find(id);
-    return it != index.end() ? &slots[it->second] : nullptr;
+  void free(uint32_t slot) { free_slots.push_back(slot); }
+
+  void clear() {
+    slots.clear();
+    free_slots.clear();
   }
+
+  ObjectUniformBuffer &operator[](uint32_t slot) { return slots[slot]; }
 };
 } // namespace zephyr
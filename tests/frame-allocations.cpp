@@ -0,0 +1,199 @@
+// Counts heap allocations in the CPU side of a frame: uniform updates, CPU
+// occlusion, instance batching, render queue sorting and frame graph
+// compilation. Built with ZEPH_COUNT_ALLOCATIONS, so every operator new in
+// the process is counted. Once storage has grown to fit the scene, a frame
+// must not allocate at all. The old by-value draw path is measured too, as
+// the before figure.
+
+#include "allocation-counter.hpp"
+#include "entity.hpp"
+#include "instancing.hpp"
+#include "occlusion-rasterizer.hpp"
+#include "platforms/vulkan/frame-graph.hpp"
+#include "render-queue.hpp"
+#include <cstdio>
+
+using namespace zephyr;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+const constexpr size_t GRID_SIZE = 16;
+const constexpr size_t WARMUP_FRAMES = 2;
+const constexpr size_t MEASURED_FRAMES = 8;
+
+struct Scene {
+  World world;
+  MeshAsset cube_asset = make_mesh_asset(Mesh::cube());
+  MeshHandle cube{
+      .index_count = static_cast<uint32_t>(cube_asset->indices.size()),
+      .bounds = cube_asset->bounding_sphere()};
+
+  OcclusionRasterizer rasterizer;
+  InstanceBatcher batcher;
+  RenderQueue queue;
+  FrameGraph graph;
+
+  Scene() {
+    rasterizer.add_mesh(cube, cube_asset);
+
+    make_entity(world)
+        .with_position({0.0f, 0.0f, -3.0f})
+        .with_component(CameraComponent{})
+        .with_component(CameraTagComponent{})
+        .spawn();
+
+    make_entity(world)
+        .with_position({3.0f, 0.0f, -1.5f})
+        .with_scale({3.0f, 2.0f, 0.25f})
+        .with_component(MeshComponent{.mesh = cube})
+        .with_component(OccluderTagComponent{})
+        .spawn();
+
+    for (size_t i = 0; i < GRID_SIZE * GRID_SIZE; i++) {
+      glm::vec3 position(static_cast<float>(i / GRID_SIZE) * 2.0f, 0.0f,
+                         static_cast<float>(i % GRID_SIZE) * 2.0f);
+
+      if (i % 3 == 0)
+        make_entity(world)
+            .with_position(position)
+            .with_component(MeshComponent{.mesh = cube})
+            .with_component(
+                MaterialComponent{.blend = BlendMode::TRANSPARENT})
+            .spawn();
+      else
+        make_entity(world)
+            .with_position(position)
+            .with_component(MeshComponent{.mesh = cube})
+            .spawn();
+    }
+  }
+
+  // The CPU work of Application::draw, in the same order.
+  void frame(float time) {
+    world.query<TransformComponent>(
+        [&](EntityId, TransformComponent &transform) {
+          transform.rotation =
+              glm::angleAxis(time, glm::vec3(0.0f, 0.0f, 1.0f));
+          transform.is_dirty = true;
+          transform.recalculate();
+        },
+        With<ObjectTagComponent>{});
+
+    world.update_uniforms();
+
+    glm::mat4 view_projection =
+        world.uniforms.global.projection * world.uniforms.global.view;
+
+    rasterizer.render(world, view_projection);
+    batcher.build(world, world.uniforms.global.view_position,
+                  BlendMode::OPAQUE, &rasterizer);
+
+    queue.clear();
+    for (uint32_t i = 0; i < batcher.batches().size(); i++) {
+      const InstanceBatch &batch = batcher.batches()[i];
+      queue.push(RenderKey::make(static_cast<uint32_t>(batch.blend), 0,
+                                 RenderKey::depth_bits(batch.depth)),
+                 i);
+    }
+    queue.sort();
+
+    // Only imported resources, so compile() never touches a device.
+    graph.reset();
+
+    auto objects = graph.import_buffer("objects", VK_NULL_HANDLE, 0, 256);
+    auto draws = graph.import_buffer("draws", VK_NULL_HANDLE, 256, 256);
+    auto readback = graph.import_buffer("readback", VK_NULL_HANDLE, 512, 64);
+
+    VkExtent2D extent{64, 64};
+    VkDeviceSize offset = 512;
+
+    graph
+        .add_pass("cull",
+                  [this](VkCommandBuffer) { (void)batcher.batches(); })
+        .read(objects,
+              {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT})
+        .write(draws, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_ACCESS_SHADER_WRITE_BIT});
+
+    graph
+        .add_pass("copy",
+                  [this, extent, offset](VkCommandBuffer) {
+                    (void)queue.size();
+                    (void)extent;
+                    (void)offset;
+                  })
+        .read(draws,
+              {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT})
+        .write(readback,
+               {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT});
+
+    graph.add_pass("readback", [](VkCommandBuffer) {})
+        .read(readback, {VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT})
+        .side_effect();
+
+    graph.compile();
+  }
+};
+
+// What every draw did before meshes were shared: copy the Mesh to read its
+// index count.
+size_t by_value_draw_allocations(const Mesh &mesh, size_t draws) {
+  size_t before = AllocationCounter::count();
+  size_t index_count = 0;
+
+  for (size_t i = 0; i < draws; i++) {
+    Mesh copy = mesh;
+    index_count += copy.indices.size();
+  }
+
+  check(index_count == draws * mesh.indices.size(), "copies hold the mesh");
+  return AllocationCounter::count() - before;
+}
+
+void test_steady_frame() {
+  Scene scene;
+
+  for (size_t i = 0; i < WARMUP_FRAMES; i++)
+    scene.frame(static_cast<float>(i));
+
+  check(!scene.batcher.batches().empty(), "the scene has batches");
+  check(scene.graph.stats().barrier_count > 0, "the graph has barriers");
+
+  size_t before = AllocationCounter::count();
+
+  for (size_t i = 0; i < MEASURED_FRAMES; i++)
+    scene.frame(static_cast<float>(WARMUP_FRAMES + i));
+
+  size_t allocations = AllocationCounter::count() - before;
+  size_t old_per_frame =
+      by_value_draw_allocations(*scene.cube_asset, GRID_SIZE * GRID_SIZE + 1);
+
+  std::printf("heap allocations: %zu per frame with by-value meshes, %zu in "
+              "%zu steady frames now\n",
+              old_per_frame, allocations, MEASURED_FRAMES);
+
+  check(old_per_frame > 0, "the counter sees allocations");
+  check(allocations == 0, "a steady frame allocates nothing");
+}
+
+} // namespace
+
+int main() {
+  test_steady_frame();
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+// CPU-only checks for how the frame graph packs transient images into
+// memory: images whose lifetimes don't overlap share a block, overlapping
+// ones never do, and a block only takes images that accept its memory type.
+// Creating the images themselves needs a device, so these drive
+// place_in_block() with made-up memory requirements.
+
+#include "platforms/vulkan/frame-graph.hpp"
+#include <cstdio>
+
+using namespace zephyr;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+VkMemoryRequirements requirements(VkDeviceSize size, uint32_t type_bits) {
+  VkMemoryRequirements result{};
+  result.size = size;
+  result.alignment = 256;
+  result.memoryTypeBits = type_bits;
+  return result;
+}
+
+void test_disjoint_lifetimes_share() {
+  std::vector<FrameGraphMemoryBlock> blocks;
+
+  uint32_t depth = place_in_block(blocks, 0, 1, requirements(4096, 0b11));
+  uint32_t bloom = place_in_block(blocks, 2, 3, requirements(1024, 0b11));
+  uint32_t blur = place_in_block(blocks, 4, 4, requirements(8192, 0b01));
+
+  check(blocks.size() == 1, "disjoint transients need one block");
+  check(depth == 0 && bloom == 0 && blur == 0,
+        "disjoint transients share the block");
+  check(blocks[0].size == 8192, "the block fits the largest transient");
+  check(blocks[0].type_bits == 0b01, "the block keeps the common types");
+  check(blocks[0].free_after == 4, "the block is busy until the last use");
+}
+
+void test_overlapping_lifetimes_split() {
+  std::vector<FrameGraphMemoryBlock> blocks;
+
+  uint32_t first = place_in_block(blocks, 0, 2, requirements(4096, 0b11));
+  uint32_t second = place_in_block(blocks, 1, 3, requirements(4096, 0b11));
+  uint32_t third = place_in_block(blocks, 3, 4, requirements(2048, 0b11));
+  uint32_t fourth = place_in_block(blocks, 4, 5, requirements(2048, 0b11));
+
+  check(blocks.size() == 2, "two overlapping transients need two blocks");
+  check(first != second, "overlapping transients get their own blocks");
+  check(third == first, "a transient reuses the first block that is free");
+  check(fourth == second, "a later transient reuses the other block");
+}
+
+void test_memory_types_split() {
+  std::vector<FrameGraphMemoryBlock> blocks;
+
+  uint32_t first = place_in_block(blocks, 0, 0, requirements(1024, 0b01));
+  uint32_t second = place_in_block(blocks, 1, 1, requirements(1024, 0b10));
+
+  check(blocks.size() == 2, "incompatible memory types need two blocks");
+  check(first != second, "a block only takes compatible memory types");
+}
+
+} // namespace
+
+int main() {
+  test_disjoint_lifetimes_share();
+  test_overlapping_lifetimes_split();
+  test_memory_types_split();
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+// CPU-only checks for OcclusionRasterizer: no window or GPU is created, so
+// this runs on headless build agents. The AVX2 and scalar row paths must
+// agree pixel for pixel; on machines without AVX2 both runs are scalar.
+
+#include "occlusion-rasterizer.hpp"
+#include <cstdio>
+#include <random>
+
+using namespace zephyr;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Maps x and y in [-10, 10] to the screen and z in [-15, 35] to [0, 1].
+glm::mat4 view_projection() {
+  return glm::mat4(glm::vec4(0.1f, 0.0f, 0.0f, 0.0f),
+                   glm::vec4(0.0f, 0.1f, 0.0f, 0.0f),
+                   glm::vec4(0.0f, 0.0f, 0.02f, 0.0f),
+                   glm::vec4(0.0f, 0.0f, 0.3f, 1.0f));
+}
+
+// A quad at z = 5 spanning [-5, 5], which lands at depth 0.4 over the
+// middle half of the screen.
+Mesh quad() {
+  std::vector<Vertex> vertices;
+  for (glm::vec2 corner : {glm::vec2(-5.0f, -5.0f), glm::vec2(5.0f, -5.0f),
+                           glm::vec2(5.0f, 5.0f), glm::vec2(-5.0f, 5.0f)})
+    vertices.push_back({glm::vec3(corner.x, corner.y, 5.0f), glm::vec3(0.0f),
+                        glm::vec2(0.0f)});
+
+  return Mesh(vertices, {0, 1, 2, 2, 3, 0});
+}
+
+Mesh random_triangles(uint32_t count) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> xy(-12.0f, 12.0f);
+  std::uniform_real_distribution<float> z(-5.0f, 20.0f);
+
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+
+  for (uint32_t i = 0; i < count * 3; i++) {
+    vertices.push_back({glm::vec3(xy(rng), xy(rng), z(rng)), glm::vec3(0.0f),
+                        glm::vec2(0.0f)});
+    indices.push_back(i);
+  }
+
+  return Mesh(vertices, indices);
+}
+
+bool same_depth(const OcclusionRasterizer &a, const OcclusionRasterizer &b) {
+  for (uint32_t y = 0; y < a.height(); y++) {
+    for (uint32_t x = 0; x < a.width(); x++) {
+      if (std::abs(a.depth_at(x, y) - b.depth_at(x, y)) > 1e-5f)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void test_quad(bool simd) {
+  OcclusionRasterizer rasterizer(64, 32);
+  rasterizer.set_simd(simd);
+
+  World world;
+  MeshHandle handle{};
+  handle.index_count = 6;
+
+  rasterizer.add_mesh(handle, make_mesh_asset(quad()));
+  EntityId wall = make_entity(world)
+                      .with_component(MeshComponent{.mesh = handle})
+                      .spawn();
+  world.add_component(wall, OccluderTagComponent{});
+
+  rasterizer.render(world, view_projection());
+
+  check(rasterizer.occluder_count() == 1, "quad is drawn as an occluder");
+  check(rasterizer.triangle_count() == 2, "both quad triangles rasterize");
+  check(std::abs(rasterizer.depth_at(32, 16) - 0.4f) < 1e-5f,
+        "quad depth at the centre");
+  check(rasterizer.depth_at(0, 0) == 1.0f, "corner stays at the far plane");
+
+  check(rasterizer.occludes(glm::vec3(0.0f, 0.0f, 10.0f), 1.0f),
+        "sphere behind the quad is occluded");
+  check(!rasterizer.occludes(glm::vec3(0.0f, 0.0f, 0.0f), 1.0f),
+        "sphere in front of the quad is visible");
+  check(!rasterizer.occludes(glm::vec3(4.9f, 0.0f, 10.0f), 1.0f),
+        "sphere poking out beside the quad is visible");
+}
+
+void test_simd_matches_scalar() {
+  Mesh mesh = random_triangles(100);
+
+  OcclusionRasterizer simd(96, 40);
+  OcclusionRasterizer scalar(96, 40);
+  scalar.set_simd(false);
+
+  simd.draw_mesh(quad(), view_projection());
+  scalar.draw_mesh(quad(), view_projection());
+  check(same_depth(simd, scalar), "quad depth matches between paths");
+
+  simd.draw_mesh(mesh, view_projection());
+  scalar.draw_mesh(mesh, view_projection());
+  check(same_depth(simd, scalar), "random triangles match between paths");
+  check(simd.triangle_count() == scalar.triangle_count(),
+        "both paths rasterize the same triangles");
+
+  for (float x = -9.0f; x <= 9.0f; x += 1.5f) {
+    for (float z = -4.0f; z <= 30.0f; z += 2.0f) {
+      glm::vec3 center(x, 0.5f * x, z);
+      check(simd.occludes(center, 0.5f) == scalar.occludes(center, 0.5f),
+            "occlusion tests match between paths");
+    }
+  }
+
+  std::printf("AVX2 path %s\n", simd.simd() ? "tested" : "unavailable");
+}
+
+} // namespace
+
+int main() {
+  test_quad(true);
+  test_quad(false);
+  test_simd_matches_scalar();
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+// CPU-only checks for the World snapshot ring: captures share every chunk
+// that did not change since the previous one, read-only queries keep that
+// sharing, and restore() brings back the captured bytes.
+
+#include "entity.hpp"
+#include <cstdio>
+
+using namespace zephyr;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Enough rows to span several snapshot chunks of TransformComponent.
+const constexpr size_t ENTITY_COUNT = 1000;
+
+const ColumnSnapshot *transforms(const World &world, size_t frames_back) {
+  const WorldSnapshot *snap = world.snapshot_at(frames_back);
+  if (!snap)
+    return nullptr;
+
+  for (size_t i = 0; i < snap->archetype_count; i++) {
+    if (snap->archetypes[i].entity_ids.size() == ENTITY_COUNT)
+      return snap->archetypes[i].find(component_type_id<TransformComponent>());
+  }
+
+  return nullptr;
+}
+
+// Counts the chunks the two latest captures hold by the same pointer.
+size_t shared_chunks(const World &world) {
+  const ColumnSnapshot *latest = transforms(world, 0);
+  const ColumnSnapshot *previous = transforms(world, 1);
+  if (!latest || !previous || latest->chunks.size() != previous->chunks.size())
+    return 0;
+
+  size_t shared = 0;
+  for (size_t c = 0; c < latest->chunks.size(); c++)
+    shared += latest->chunks[c] == previous->chunks[c];
+
+  return shared;
+}
+
+void test_sharing() {
+  World world;
+  world.enable_snapshots(4);
+
+  std::vector<EntityId> ids;
+  for (size_t i = 0; i < ENTITY_COUNT; i++)
+    ids.push_back(make_entity(world)
+                      .with_position(glm::vec3(static_cast<float>(i)))
+                      .with_component(MeshComponent{})
+                      .spawn());
+
+  SnapshotStats first = world.snapshot();
+  check(first.chunks_shared == 0, "first capture copies every chunk");
+
+  const ColumnSnapshot *column = transforms(world, 0);
+  check(column && column->chunks.size() > 2,
+        "transforms span several chunks");
+  if (!column)
+    return;
+  size_t chunk_count = column->chunks.size();
+
+  SnapshotStats idle = world.snapshot();
+  check(idle.bytes_copied == 0, "idle capture copies nothing");
+  check(shared_chunks(world) == chunk_count,
+        "idle capture shares every transform chunk");
+
+  world.query<TransformComponent>(
+      [](EntityId, const TransformComponent &transform) { (void)transform; });
+  world.query<TransformComponent>(
+      [](EntityId, const auto &transform) { (void)transform; });
+  SnapshotStats read = world.snapshot();
+  check(read.bytes_copied == 0, "read-only queries copy nothing");
+  check(shared_chunks(world) == chunk_count,
+        "read-only queries keep every transform chunk shared");
+
+  world.get_component<TransformComponent>(ids[ENTITY_COUNT / 2])->position.x =
+      -1.0f;
+  world.snapshot();
+  check(shared_chunks(world) == chunk_count - 1,
+        "one write copies only its chunk");
+
+  world.get_component<TransformComponent>(ids[ENTITY_COUNT / 2])->position.x =
+      -2.0f;
+  world.restore(0);
+  check(world.get_component<TransformComponent>(ids[ENTITY_COUNT / 2])
+                ->position.x == -1.0f,
+        "restore brings back the captured value");
+}
+
+} // namespace
+
+int main() {
+  test_sharing();
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}